@@ -1,36 +1,349 @@
 #define M61_DISABLE 1
+#define _GNU_SOURCE
 #include "m61.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <math.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <link.h>
+#include <setjmp.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__)||defined(__i386__)
+#include <x86intrin.h>
+#endif
 
-#define THETA 25 
-#define NUMBERCOUNTERS (int)(100/THETA-1)
+#define THETA 25           //default for M61_THETA: sites above THETA percent are guaranteed to be tracked
+#define REPORTTHRESHOLD 5   //the report shows sites above this percentage (or above theta, if that's smaller)
 
-unsigned long long active_count; // # active allocations
-unsigned long long active_size;	 // # bytes in active allocations
-unsigned long long total_count;	 // # total allocations
-unsigned long long total_size;	 // # bytes in total allocations
-unsigned long long fail_count;	 // # failed allocation attempts
-unsigned long long fail_size;	 // # bytes in failed alloc attempts
+#define M61_SLABSIZE ((size_t)64<<10)   //each size class carves slabs of this size out of a chunk
+#define M61_CHUNKSIZE ((size_t)4<<20)   //size of the regions that are mmap'd for slabs
+#define M61_MAXCLASS 16384              //larger blocks get a mapping of their own
+#define M61_TCACHEDEPTH 32              //a thread caches at most this many free blocks per size class
+#define M61_TCACHEBATCH 16              //blocks move between a thread cache and its size class this many at a time
+#define M61_LARGECACHE ((size_t)32<<20) //freed large mappings up to this many bytes are kept for reuse
+#define M61_LARGEEXACT 64                //cached mappings of fewer pages are kept in a bucket per number of pages
+#define M61_LARGEBUCKETS (M61_LARGEEXACT+48)    //longer ones in a bucket per power of two
+#define M61_ARENACHUNK ((size_t)64<<10) //arenas grow by chunks of this size, bigger allocations get a chunk of their own
 
-metadata *lastAlloc; //points to the object that was allocated last
-void *firstHeap;     //points to the first Address that lives on the heap
-//structs to track frequency and size of heavy hitters
-hitTracker *szTracker;
-hitTracker *freqTracker;
+#define M61_TAGMAGIC 0x6d363143u        //"m61C"
+#define M61_MAXSLOTS ((size_t)1<<28)    //the record table is reserved for this many slots up front
+#define M61_RECORDLIVE 0x80000000u
+#define M61_RECORDFREED 0x40000000u
+#define M61_RECORDSIZE 0x00ffffffu
+#define M61_RECORDOFFSET 0x3f000000u    //log2 of the offset of the payload in an aligned block, 0 if the payload follows the header
+#define M61_RECORDOFFSETSHIFT 24
+
+//the page map is a two level radix tree over 48 bit addresses with 4KB pages
+#define M61_PAGESHIFT 12
+#define M61_LEAFBITS 18
+#define M61_ROOTBITS (48-M61_PAGESHIFT-M61_LEAFBITS)
+
+//call sites are stored in pages that never move, so they can be read without a lock
+#define M61_SITEPAGEBITS 10
+#define M61_MAXSITES ((uint32_t)1<<22)
+#define M61_STACKPAGEBITS 10
+#define M61_MAXSTACKS ((uint32_t)1<<22)
+#define M61_MAXFRAMESIZE 100000         //a saved frame pointer further up than this ends the backtrace
+
+#define M61_GUARDALIGN 16               //guarded payloads end at the guard page, rounded up to this alignment
+#define M61_GUARDBATCH 64               //freed guarded blocks are unmapped this many at a time
+
+#define M61_LEVELBOUNDS 2               //index of the bounds level in checkLevels
+#define M61_LEVELFULL 3
+#define M61_UNSIZED ((size_t)-1)        //size passed to the free of a level by callers that don't know it, no block is that big
+
+#define M61_POISON 0x6b                 //freed payloads in the quarantine are filled with this byte
+#define M61_REDZONEBYTE 0xfd            //redzones behind the backpack are filled with this byte
+#define M61_MAXREDZONE 4096
+#define M61_SWEEPBATCH 64               //the sweeper checks this many blocks of a thread under its lock at a time
+#define M61_SWEEPPAUSE 1000000          //the sweeper sleeps at least this many nanoseconds between two rounds
+
+#define M61_TRACEBUFFER ((size_t)64<<10)    //size of the trace buffer of a thread
+#define M61_TRACEEVENT 64                   //the buffer is drained when less than this is left, enough for any event but a site
+#define M61_TRACEFILENAME 1024              //longer file names of sites are cut off in the trace
+#define M61_TRACEMAX ((size_t)1<<36)        //the trace file is mapped with this length up front and grown with ftruncate()
+#define M61_TRACEGROWTH ((size_t)64<<20)
+#define M61_TRACEHEADER 16
+#define M61_TRACECHUNKHEADER 16
+
+#define M61_STATSINTERVAL 1000              //default for M61_STATS_INTERVAL: milliseconds between updates of the shared statistics page
+
+#define M61_CLOCKBATCH 64                   //ticks of the allocation clock that a thread takes at a time
+#define M61_TSCSHIFT 10                     //with M61_CLOCK=tsc a tick of the lifetime clock is 2^M61_TSCSHIFT TSC cycles
+#define M61_PEAKBATCH 64                    //a thread adds its changes of the active allocations to the global counters after this many
+#define M61_PEAKBATCHSIZE ((long long)64<<10)   //or after this many bytes
+#define M61_TIMELINEINTERVAL 100            //default for M61_TIMELINE_INTERVAL: milliseconds between snapshots of the timeline
+#define M61_TIMELINESITES 8                 //a snapshot of the timeline shows this many call sites with the most active bytes
+#define M61_TIMELINELINE 4096               //longest line of the timeline, sites that don't fit are left out
+
+threadState *threads;                   //shards of all threads that ever allocated
+__thread threadState *myThread __attribute__((tls_model("initial-exec")));   //shard of the calling thread, initial-exec so that no access can allocate
+pthread_key_t threadKey;                //retires the shard when its thread exits
+threadState *forkThreads;               //the shards that were locked by forkPrepare()
+
+//heapLock protects the chunks, the large cache, the span descriptors and the internal memory
+//the size classes have a lock each, so that malloc and free of different classes don't contend
+pthread_mutex_t heapLock=PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t siteLock=PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t stackLock=PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t quarantineLock=PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t traceFileLock=PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t statsLock=PTHREAD_MUTEX_INITIALIZER;     //makes the stats thread and the final update at exit take turns
+pthread_mutex_t timelineLock=PTHREAD_MUTEX_INITIALIZER;  //keeps the snapshots of the timeline in order
+pthread_mutex_t peakLock=PTHREAD_MUTEX_INITIALIZER;      //makes a peak and the site that set it change together
+pthread_once_t initOnce=PTHREAD_ONCE_INIT;
+size_t pageSize;
+sizeClass sizeClasses[M61_NCLASSES]={[0 ... M61_NCLASSES-1]={.lock=PTHREAD_MUTEX_INITIALIZER}};
+char *chunkNext;     //next unused slab of the current chunk
+char *chunkEnd;
+metadata *largeCache[M61_LARGEBUCKETS]; //freed large mappings by largeBucket() of their length, linked through metadata->next
+size_t largeCacheSize;
+span **pageMap[1<<M61_ROOTBITS];  //page number -> span, leaves are mapped on demand
+span *slabs;          //all slabs that were handed out
+span *spareSpans;     //unused span descriptors
+
+char *internalNext;   //bump pointer for small internal structures
+char *internalEnd;
+
+int m61Initialized;
+FILE *reportFile;     //where the reports and bug messages go, stdout unless libm61.so picks another stream
+int compactMode;      //set by the environment variable M61_COMPACT
+int compactDisabled;  //set by libm61.so: a replacement for malloc() has to return 16 byte aligned payloads, compact payloads are only 8 byte aligned
+double theta=THETA;   //set by the environment variable M61_THETA (in percent)
+int numberCounters;   //counters per heavy hitter summary, 100/theta rounded up
+double sampleRate;    //set by the environment variable M61_SAMPLE: mean number of bytes between sampled allocations, 0 tracks everything
+int untrackedBlocks;  //set if blocks without an owner are live blocks: in sampling mode and at the bounds level
+uint64_t sampleSeed;  //seeds of the threads' random number generators
+allocRecord *records; //side table of compact mode, indexed by the slot of a block
+uint32_t nextSlot;
+callSite *sitePages[M61_MAXSITES>>M61_SITEPAGEBITS];    //interned call sites, id 0 is unused
+uint32_t nsites;
+siteTable *siteIndex; //open addressing hash table of the interned file name pointers and lines, replaced (but never unmapped) when it grows
+uint32_t *siteNames;  //open addressing hash table of site ids by the contents of the file name (capacity in the first element), only used under siteLock
+uint32_t nentries;    //entries of siteIndex, more than nsites when file names with the same contents have different addresses
+size_t redzoneSize;       //set by the environment variable M61_REDZONE: bytes of M61_REDZONEBYTE behind the backpack of every block with metadata
+size_t trailerSize=sizeof(backpack);    //the backpack and the redzone
+int sweepBudget;          //set by the environment variable M61_SWEEP: percent of a CPU that the sweeper thread may use, 0 turns it off
+size_t guardThreshold;    //set by the environment variable M61_GUARD: allocations of at least this many bytes are guarded, 0 turns guarding off
+span *guardPending;       //spans of freed guarded blocks that are still mapped
+int guardPendingCount;
+size_t quarantineBudget;  //set by the environment variable M61_QUARANTINE: bytes of freed payloads that are held back from reuse, 0 turns the quarantine off
+quarantineEntry *quarantine;  //ring buffer of the quarantined blocks, oldest first
+size_t quarantineCapacity;
+size_t quarantineHead;
+size_t quarantineCount;
+size_t quarantineBytes;
+int tracing;          //set by the environment variable M61_TRACE (the name of the trace file), cleared when the trace is closed at exit
+int traceFd;
+char *traceMap;       //shared mapping of the trace file
+size_t traceOffset;   //end of the chunks that were reserved so far
+size_t traceFileSize;
+uint32_t nthreads;
+int stackDepth;       //set by the environment variable M61_STACKS: number of frames to capture, 0 tracks call sites only
+callStack *stackPages[M61_MAXSTACKS>>M61_STACKPAGEBITS];  //interned call stacks, id 0 stands for stacks that couldn't be interned
+uint32_t nstacks;
+uint32_t *stackIndex; //hash table of stack ids, works like siteIndex
+struct m61_stats_page *statsPage;   //set by the environment variable M61_STATS: shared page of the statistics
+char statsName[256];
+pid_t statsPid;       //the process that created the page, a forked child leaves it alone
+long statsInterval=M61_STATSINTERVAL;
+uint32_t allocationClock; //ticks of the allocation clock that were handed to the threads so far
+int tscClock;         //set by the environment variable M61_CLOCK=tsc: lifetimes are measured with the TSC instead of the allocation clock
+int printHistograms;  //set by the environment variable M61_HISTOGRAMS: the heavy hitter report prints the histograms
+int printPeaks;       //set by the environment variable M61_PEAKS: the heavy hitter report prints the peaks
+int siteStatistics;   //call sites keep statistics of their own, for the histograms, the peaks or the timeline
+siteStats *siteStatsPages[M61_MAXSITES>>M61_SITEPAGEBITS];   //statistics of the call sites, pages are mapped when they are first needed
+unsigned long long activeCount;   //active allocations and bytes of all threads, without the changes that the threads didn't flush yet
+unsigned long long activeSize;
+struct m61_peaks peaks;
+int timelineFd=-1;    //set by the environment variable M61_TIMELINE: file that the timeline of the active bytes is written to
+unsigned long long timelineStart;
+long timelineInterval=M61_TIMELINEINTERVAL;
+uint32_t timelineAllocations; //set by the environment variable M61_TIMELINE_ALLOCATIONS: snapshots are taken every this many allocations instead
+pid_t timelinePid;
+int leakSummary;      //set by the environment variable M61_LEAKS: m61_printleakreport() prints the summary by call site (1), with the mark phase (2)
+#ifdef __GLIBC__
+extern void *__libc_stack_end;    //top of the main thread's stack, backtraces never go beyond it
+#endif
 
 //functions that are not part of the public api
 metadata *getMetadata(void *ptr);
 void *getPayload(metadata *ptr);
 size_t maximumSizeValid();
-unsigned short int addressIsInHeap(void *ptr);
-void allocationFailedWithSize(size_t sz);
-metadata *scanMemoryForAllocation(void *ptr);
-void trackAllocByHH(size_t sz, const char *file, int line);
-void updateCounters(hitTracker *tracker, int elements, size_t occurrence, const char *file, int line);
+span *addressIsInHeap(void *ptr);
+void allocationFailedWithSize(threadState *t, size_t sz);
+void addCounter(unsigned long long *counter, unsigned long long delta);
+int sizeBucket(size_t sz);
+int lifetimeBucket(uint32_t ticks);
+uint32_t tscTicks(void);
+uint32_t birthTime(threadState *t);
+uint32_t lifetimeClock(threadState *t);
+siteStats *siteStatsAt(uint32_t site);
+void raisePeak(unsigned long long *peak, unsigned long long value);
+void flushActive(threadState *t);
+void countAllocation(threadState *t, size_t sz, uint32_t site, const char *file, int line);
+void countFree(threadState *t, size_t sz, uint32_t birth, uint32_t site);
+void printHistogram(const char *title, const unsigned long long *buckets, int n);
+void m61Init(void);
+FILE *reportStream(void);
+void forkPrepare(void);
+void forkRelease(void);
+void forkChild(void);
+void *mapInternal(size_t len);
+void *allocateInternal(size_t len);
+threadState *currentThread(void);
+void retireThread(void *arg);
+int isThreadState(threadState *t);
+callSite *siteAt(uint32_t id);
+uint32_t siteHash(const char *file, int line);
+uint32_t siteNameHash(const char *file, int line);
+uint32_t siteByName(const char *file, int line);
+uint32_t siteIntern(const char *file, int line);
+int captureStack(void **frame, void **frames);
+callStack *stackAt(uint32_t id);
+uint32_t stackHash(uint32_t site, void **frames, int depth);
+uint32_t stackIntern(uint32_t site, void **frames, int depth);
+uint32_t trackingKey(uint32_t site, void **frame);
+uint32_t keySiteId(uint32_t key);
+callSite *keySite(uint32_t key);
+void printStack(uint32_t key);
+void stackLeakReport(void);
+int compareStackLeaks(const void *a, const void *b);
+void printLeakSummary(int mark, void **frame);
+size_t collectLiveBlocks(leakBlock *blocks, size_t capacity);
+int compareLeakBlocks(const void *a, const void *b);
+int compareSiteLeaks(const void *a, const void *b);
+void markRange(leakMark *mark, const char *start, const char *end);
+int markSegments(struct dl_phdr_info *info, size_t size, void *data);
+void markStacks(leakMark *mark, void **frame);
+void markReachable(leakMark *mark, void **frame);
+size_t snapshotLength(size_t nsites);
+int compareSnapshotSites(const void *a, const void *b);
+int compareSiteGrowth(const void *a, const void *b);
+void *mallocAt(size_t sz, const char *file, int line, uint32_t site, void **frame);
+void *mallocCall(size_t sz, const char *file, int line, uint32_t site, void **frame);
+void *reallocCall(void *ptr, size_t sz, const char *file, int line, uint32_t site, void **frame);
+void *callocCall(size_t nmemb, size_t sz, const char *file, int line, uint32_t site, void **frame);
+void *memalignCall(size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame);
+int posixMemalignCall(void **memptr, size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame);
+void freeSizedCall(void *ptr, size_t sz, const char *file, int line, uint32_t site);
+void reportSizeMismatch(void *ptr, size_t sz, size_t allocated, const char *file, int line);
+void freeAt(void *ptr, size_t sized, const char *file, int line, uint32_t site);
+void traceInit(const char *path);
+void traceFinish(void);
+unsigned long long traceClock(void);
+unsigned char *putVarint(unsigned char *out, uint64_t value);
+void traceDrain(threadState *t);
+void traceEvent(int op, const char *file, int line, size_t sz, void *ptr, void *newPtr, uint32_t site);
+void traceSite(uint32_t id, const char *file, int line);
+void statsInit(const char *name);
+void *statsThread(void *arg);
+void publishStats(void);
+uint32_t publishHitters(struct m61_stats_site *sites, hitTracker *merged, int elements);
+void statsFinish(void);
+void timelineInit(const char *path);
+void *timelineThread(void *arg);
+void timelineSnapshot(void);
+void *recordAllocation(threadState *t, metadata *meta_ptr, size_t sz, const char *file, int line, uint32_t site, void **frame);
+void unlinkBlock(threadState *owner, metadata *meta_ptr);
+void *reallocInPlace(void *ptr, size_t sz, const char *file, int line, uint32_t site, void **frame);
+metadata *remapLarge(span *s, size_t len);
+span *newSpan(char *start, size_t len, size_t blocksz);
+void deleteSpan(span *s);
+char *blockContaining(span *s, void *ptr);
+int sizeClassIndex(size_t blocksz);
+size_t sizeClassBlockSize(int index);
+size_t largeMappingSize(size_t blocksz);
+int largeBucket(size_t len);
+void *mapMemory(size_t len);
+int refillSlab(sizeClass *cls, int index);
+void *allocateBlock(size_t blocksz);
+void freeBlock(void *block, size_t blocksz);
+threadState *cachingThread(void);
+int refillCache(threadState *t, int index);
+void flushCache(threadState *t, int index, uint32_t n);
+compactHeader *findCompactBlock(span *s, void *ptr);
+void *compactMalloc(threadState *t, size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame);
+void *compactRecordAllocation(threadState *t, compactHeader *header, unsigned shift, size_t sz, const char *file, int line, uint32_t site, void **frame);
+void *compactPayload(compactHeader *header, uint32_t szflags);
+void *compactRealloc(span *s, void *ptr, size_t sz, const char *file, int line, uint32_t site, void **frame);
+void compactFree(span *s, void *ptr, size_t sized, const char *file, int line, uint32_t site);
+void compactLeakReport(void);
+size_t payloadSize(void *ptr);
+double sampleRandom(threadState *t);
+int sampleAllocation(threadState *t, size_t sz);
+double sampleWeight(size_t sz);
+unsigned long long roundRandomly(threadState *t, double x);
+void unlockedFree(span *s, metadata *meta_ptr, size_t capacity, void *ptr, threadState *owner, const char *file, int line, uint32_t site);
+void drainRemoteFrees(threadState *t);
+backpack *findBackpack(span *s, void *ptr, size_t sz, size_t capacity);
+int backpackIntact(span *s, backpack *backpack_ptr);
+size_t blockCapacity(span *s, metadata *meta_ptr);
+int isGuardedSize(size_t sz);
+size_t guardedMappingSize(size_t sz, size_t alignment);
+metadata *allocateGuarded(size_t sz, size_t alignment);
+metadata *allocateAligned(size_t sz, size_t alignment);
+void *memalignAt(size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame);
+metadata *allocateAlignedBlock(size_t alignment, size_t sz);
+void initBlock(threadState *t, metadata *meta_ptr, size_t sz, const char *file, int line, uint32_t site);
+void *untrackedAllocation(threadState *t, metadata *meta_ptr, size_t sz, const char *file, int line);
+void *offAllocation(metadata *meta_ptr, size_t sz);
+void *offMalloc(size_t sz, const char *file, int line, uint32_t site, void **frame);
+void *offMemalign(size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame);
+void offFree(void *ptr, size_t sized, const char *file, int line, uint32_t site);
+void *countersAllocation(threadState *t, metadata *meta_ptr, size_t sz, const char *file, int line);
+void *countersMalloc(size_t sz, const char *file, int line, uint32_t site, void **frame);
+void *countersMemalign(size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame);
+void countersFree(void *ptr, size_t sized, const char *file, int line, uint32_t site);
+void *boundsAllocation(threadState *t, metadata *meta_ptr, size_t sz, const char *file, int line, uint32_t site);
+void *boundsMalloc(size_t sz, const char *file, int line, uint32_t site, void **frame);
+void *boundsMemalign(size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame);
+void *noReallocInPlace(void *ptr, size_t sz, const char *file, int line, uint32_t site, void **frame);
+void *startMalloc(size_t sz, const char *file, int line, uint32_t site, void **frame);
+void startFree(void *ptr, size_t sz, const char *file, int line, uint32_t site);
+void *startMemalign(size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame);
+void *startReallocInPlace(void *ptr, size_t sz, const char *file, int line, uint32_t site, void **frame);
+void retireGuarded(span *s);
+void releaseBlock(span *s, metadata *meta_ptr, size_t sz);
+void quarantineBlock(void *block, size_t blocksz, void *payload, size_t sz, int compact);
+size_t findMismatch(const unsigned char *p, size_t n, unsigned char pattern);
+int sweepBlock(threadState *t, metadata *meta_ptr);
+void sweepShard(threadState *t);
+void *sweepThread(void *arg);
+void checkQuarantined(quarantineEntry *entry);
+void trackAllocByHH(threadState *t, size_t sz, uint32_t site, double weight);
+int initSummary(hitSummary *summary, int capacity);
+void siftDown(hitSummary *summary, int pos);
+void siftUp(hitSummary *summary, int pos);
+hitTracker *mergeHitTrackers(int sizeTracker, int *elements);
+void printHitTrackers(hitTracker *merged, int elements, unsigned long long total, const char *unit);
+void updateCounters(hitSummary *summary, size_t occurrence, uint32_t site);
 void sortHitTracker(hitTracker *tracker, int elements);
+int compareHitTrackers(const void *a, const void *b);
+
+//the functions of each checking level, indexed by the level; until m61 is initialized the functions of startLevel pick the level first
+const checkLevel startLevel={startMalloc,startFree,startMemalign,startReallocInPlace};
+const checkLevel checkLevels[]={
+    {offMalloc,offFree,offMemalign,noReallocInPlace},
+    {countersMalloc,countersFree,countersMemalign,noReallocInPlace},
+    {boundsMalloc,freeAt,boundsMemalign,noReallocInPlace},
+    {mallocAt,freeAt,memalignAt,reallocInPlace},
+};
+const char *levelNames[]={"off","counters","bounds","full"};
+const checkLevel *checks=&startLevel;   //set by the environment variable M61_LEVEL
+int level=M61_LEVELFULL;
 
 //returns the address of the metadata when given a ptr to the ptr passed to the user
 metadata *getMetadata(void *ptr){
@@ -48,307 +361,3258 @@ void *getPayload(metadata *ptr){
 
 //Returns the maximum size that a variable with type size_t can have in order to be malloced with the structs 'metadata' and 'backpack'
 size_t maximumSizeValid(){
-    return (size_t)-1-sizeof(metadata)-sizeof(backpack);
+    return (size_t)-1-sizeof(metadata)-trailerSize;
 }
 
-//Checks whether ptr points to an address that is in the heap
-unsigned short int addressIsInHeap(void *ptr){
-    if(!firstHeap)
-        firstHeap=(void *)&total_size;
-    char a;
-    if((void *)&a<ptr)
-        return 0;
-    if((void *)firstHeap>ptr) 
-        return 0;
-    return 1;
+//Checks whether ptr points to an address that is in the heap, returns the span that contains ptr or NULL
+span *addressIsInHeap(void *ptr){
+    uintptr_t page=(uintptr_t)ptr>>M61_PAGESHIFT;
+    if(page>>(M61_ROOTBITS+M61_LEAFBITS))
+        return NULL;
+    span **leaf=__atomic_load_n(&pageMap[page>>M61_LEAFBITS],__ATOMIC_ACQUIRE);
+    if(!leaf)
+        return NULL;
+    return __atomic_load_n(&leaf[page&((1<<M61_LEAFBITS)-1)],__ATOMIC_ACQUIRE);
 }
 
-void allocationFailedWithSize(size_t sz){
-    ++fail_count;
-    fail_size+=(unsigned long long)sz;
+void allocationFailedWithSize(threadState *t, size_t sz){
+    addCounter(&t->fail_count,1);
+    addCounter(&t->fail_size,(unsigned long long)sz);
 }
 
-//recursively scans the memory left of a given pointer and returns a pointer to the adress of the metadata of the found allocation
-metadata *scanMemoryForAllocation(void *ptr){
-    if(!addressIsInHeap(ptr))
-        return NULL;
-    metadata *meta_ptr=(metadata *)ptr;
-    if(meta_ptr->self==meta_ptr)
-        return meta_ptr; 
-    else 
-        return scanMemoryForAllocation(--ptr);
+//counters of a shard are only written by their thread, but they are read by the reports of other threads at any time
+//a relaxed atomic store makes sure the readers never see a torn value, without a locked instruction
+void addCounter(unsigned long long *counter, unsigned long long delta){
+    __atomic_store_n(counter,*counter+delta,__ATOMIC_RELAXED);
 }
 
-void *m61_malloc(size_t sz, const char *file, int line) {
-    (void) file, (void) line;   //avoid uninitialized variable warnings
-    if(sz>maximumSizeValid()){
-        allocationFailedWithSize(sz);
-	    return NULL;
+//returns the histogram bucket of an allocation of sz bytes
+int sizeBucket(size_t sz){
+    int bucket=sz?64-__builtin_clzll((unsigned long long)sz):0;
+    return bucket<M61_SIZEBUCKETS?bucket:M61_SIZEBUCKETS-1;
+}
+
+//returns the histogram bucket of a lifetime of the given number of ticks, buckets work like the ones of the sizes
+int lifetimeBucket(uint32_t ticks){
+    return ticks?32-__builtin_clz(ticks):0;
+}
+
+uint32_t tscTicks(void){
+#if defined(__x86_64__)||defined(__i386__)
+    return (uint32_t)(__rdtsc()>>M61_TSCSHIFT);
+#else
+    return 0;
+#endif
+}
+
+//returns the time of birth of a new allocation and advances the allocation clock by one tick
+//a thread takes M61_CLOCKBATCH ticks of the global clock at a time, so that threads don't contend on it; the ticks of a thread lag behind the
+//global clock by at most that many allocations. Snapshots of the timeline that are taken every so many allocations are taken here.
+uint32_t birthTime(threadState *t){
+    if(t->clockNext==t->clockEnd){
+        t->clockNext=__atomic_fetch_add(&allocationClock,M61_CLOCKBATCH,__ATOMIC_RELAXED);
+        t->clockEnd=t->clockNext+M61_CLOCKBATCH;
+        //a snapshot is due if the new ticks include a multiple of timelineAllocations
+        uint32_t first=t->clockNext;
+        if(timelineAllocations&&(first%timelineAllocations==0||first/timelineAllocations!=(first+M61_CLOCKBATCH-1)/timelineAllocations))
+            timelineSnapshot();
     }
-	    
-    metadata *meta_ptr=malloc(sizeof(metadata)+sz+sizeof(backpack));
-	if(meta_ptr==NULL){
-        allocationFailedWithSize(sz);
-		return NULL;
-	}
-	
-    trackAllocByHH(sz,file,line);   //update HeavyHitterStats
-    memset(meta_ptr, 0, sz+sizeof(metadata)+sizeof(backpack));
-    if((char *)firstHeap>(char *)meta_ptr||!firstHeap)
-        firstHeap=(void *)meta_ptr;
-   
-    //update links in doubly linked list 
-    if(lastAlloc){
-        lastAlloc->next=meta_ptr;
-        meta_ptr->prv=lastAlloc;
-    }
-    lastAlloc=meta_ptr;
-     
-    ++total_count;
-	++active_count;
-	total_size+=sz;
-	active_size+=(unsigned long long)sz;
-	//save size and address of metadata struct to metadata
-    meta_ptr->sz=sz;
-    meta_ptr->self=meta_ptr;
-    meta_ptr->previously_freed=0;
-    meta_ptr->file=file;
-    meta_ptr->line=line;
-    //save address of metadata struct to backpack
-    backpack *backpack_ptr=(backpack *)((char *)meta_ptr+sz+sizeof(metadata));
-    backpack_ptr->self=backpack_ptr;
-	return getPayload(meta_ptr); 
+    if(tscClock)
+        return tscTicks();
+    return t->clockNext++;
 }
 
-void m61_free(void *ptr, const char *file, int line) {
-    (void) file, (void) line;    //avoid uninitialized variable warnings
-    if(ptr==NULL){
-        return;   
+//returns the current time of the lifetime clock for the thread t: its own next tick as long as no other thread took ticks after it
+//(which makes the clock exact in a single thread), the end of all ticks that were handed out otherwise
+uint32_t lifetimeClock(threadState *t){
+    if(tscClock)
+        return tscTicks();
+    uint32_t now=__atomic_load_n(&allocationClock,__ATOMIC_RELAXED);
+    return now==t->clockEnd?t->clockNext:now;
+}
+
+//returns the statistics of a call site, or NULL if call sites don't have statistics
+siteStats *siteStatsAt(uint32_t site){
+    if(!siteStatistics||!site)
+        return NULL;
+    siteStats **page=&siteStatsPages[site>>M61_SITEPAGEBITS];
+    siteStats *stats=__atomic_load_n(page,__ATOMIC_ACQUIRE);
+    if(!stats){
+        siteStats *fresh=mapInternal(sizeof(siteStats)<<M61_SITEPAGEBITS);
+        if(!fresh)
+            return NULL;
+        if(__atomic_compare_exchange_n(page,&stats,fresh,0,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE))
+            stats=fresh;
+        else
+            munmap(fresh,sizeof(siteStats)<<M61_SITEPAGEBITS);
     }
-    if(!addressIsInHeap(ptr)){
-        printf("MEMORY BUG: %s:%i: invalid free of pointer %p, not in heap\n",file,line,ptr);
+    return &stats[site&((1<<M61_SITEPAGEBITS)-1)];
+}
+
+//sets *peak to value if value is bigger, for counters that are shared by the threads
+void raisePeak(unsigned long long *peak, unsigned long long value){
+    unsigned long long old=__atomic_load_n(peak,__ATOMIC_RELAXED);
+    while(value>old&&!__atomic_compare_exchange_n(peak,&old,value,1,__ATOMIC_RELAXED,__ATOMIC_RELAXED))
+        ;
+}
+
+//adds the changes of the thread's active allocations to the global counters, the highest point of the batch on top of the counters
+//before it is a new peak if it's above the old one, and is attributed to the allocation that reached it
+void flushActive(threadState *t){
+    unsigned long long count=__atomic_add_fetch(&activeCount,(unsigned long long)t->unflushedCount,__ATOMIC_RELAXED);
+    unsigned long long size=__atomic_add_fetch(&activeSize,(unsigned long long)t->unflushedSize,__ATOMIC_RELAXED);
+    struct m61_peaks batch=t->batchPeak;
+    batch.count+=count-(unsigned long long)t->unflushedCount;
+    batch.size+=size-(unsigned long long)t->unflushedSize;
+    t->unflushedCount=0;
+    t->unflushedSize=0;
+    memset(&t->batchPeak,0,sizeof(t->batchPeak));
+    if((!batch.count_file||batch.count<=__atomic_load_n(&peaks.count,__ATOMIC_RELAXED))
+       &&(!batch.size_file||batch.size<=__atomic_load_n(&peaks.size,__ATOMIC_RELAXED)))
         return;
+    pthread_mutex_lock(&peakLock);
+    if(batch.count_file&&batch.count>peaks.count){
+        __atomic_store_n(&peaks.count,batch.count,__ATOMIC_RELAXED);
+        peaks.count_file=batch.count_file;
+        peaks.count_line=batch.count_line;
     }
-    metadata *meta_ptr=getMetadata(ptr);
-    if(meta_ptr->previously_freed){
-        printf("MEMORY BUG: %s:%i: double free of pointer %p\n",file,line,ptr);
-        printf("  %s:%i: pointer %p previously freed here\n",meta_ptr->file,meta_ptr->line,ptr);
+    if(batch.size_file&&batch.size>peaks.size){
+        __atomic_store_n(&peaks.size,batch.size,__ATOMIC_RELAXED);
+        peaks.size_file=batch.size_file;
+        peaks.size_line=batch.size_line;
+    }
+    pthread_mutex_unlock(&peakLock);
+}
+
+//adds a new allocation of sz bytes at file:line to the statistics shard of the thread, and to the statistics of its call site (0 if it wasn't sampled)
+//the global active counters only see the changes of a thread in batches, the thread remembers the highest point of its batch until then;
+//that keeps the peaks exact in a single thread, with more threads a peak puts the highest point of one thread's batch on top of what
+//the others flushed by the end of that batch, which is off by their unflushed changes (M61_PEAKBATCH allocations and M61_PEAKBATCHSIZE
+//bytes each) and whatever they flushed while the batch was open
+void countAllocation(threadState *t, size_t sz, uint32_t site, const char *file, int line){
+    addCounter(&t->total_count,1);
+    addCounter(&t->active_count,1);
+    addCounter(&t->total_size,(unsigned long long)sz);
+    addCounter(&t->active_size,(unsigned long long)sz);
+    addCounter(&t->sizeHistogram[sizeBucket(sz)],1);
+    ++t->unflushedCount;
+    t->unflushedSize+=(long long)sz;
+    if(t->unflushedCount>(long long)t->batchPeak.count){
+        t->batchPeak.count=(unsigned long long)t->unflushedCount;
+        t->batchPeak.count_file=file;
+        t->batchPeak.count_line=line;
+    }
+    if(t->unflushedSize>(long long)t->batchPeak.size){
+        t->batchPeak.size=(unsigned long long)t->unflushedSize;
+        t->batchPeak.size_file=file;
+        t->batchPeak.size_line=line;
+    }
+    if(t->unflushedCount>=M61_PEAKBATCH||t->unflushedSize>=M61_PEAKBATCHSIZE)
+        flushActive(t);
+    siteStats *stats=siteStatsAt(site);
+    if(stats){
+        __atomic_fetch_add(&stats->histograms.size[sizeBucket(sz)],1,__ATOMIC_RELAXED);
+        raisePeak(&stats->peak_count,__atomic_add_fetch(&stats->active_count,1,__ATOMIC_RELAXED));
+        raisePeak(&stats->peak_size,__atomic_add_fetch(&stats->active_size,(unsigned long long)sz,__ATOMIC_RELAXED));
+    }
+}
+
+//removes a freed allocation of sz bytes that was born at birth from the statistics shard of the thread and counts its lifetime
+void countFree(threadState *t, size_t sz, uint32_t birth, uint32_t site){
+    addCounter(&t->active_count,-1ULL);
+    addCounter(&t->active_size,-(unsigned long long)sz);
+    --t->unflushedCount;
+    t->unflushedSize-=(long long)sz;
+    if(t->unflushedCount<=-M61_PEAKBATCH||t->unflushedSize<=-M61_PEAKBATCHSIZE)
+        flushActive(t);
+    //another thread's ticks may be ahead of the freeing thread's clock, such a negative lifetime counts as 0
+    uint32_t lifetime=lifetimeClock(t)-birth;
+    int bucket=lifetimeBucket((int32_t)lifetime<0?0:lifetime);
+    addCounter(&t->lifetimeHistogram[bucket],1);
+    siteStats *stats=siteStatsAt(site);
+    if(stats){
+        __atomic_fetch_add(&stats->histograms.lifetime[bucket],1,__ATOMIC_RELAXED);
+        __atomic_fetch_sub(&stats->active_count,1,__ATOMIC_RELAXED);
+        __atomic_fetch_sub(&stats->active_size,(unsigned long long)sz,__ATOMIC_RELAXED);
+    }
+}
+
+//reads the configuration from the environment, this happens once before the first allocation
+void m61Init(void){
+    pageSize=(size_t)sysconf(_SC_PAGESIZE);
+    pthread_key_create(&threadKey,retireThread);
+    pthread_atfork(forkPrepare,forkRelease,forkChild);
+    //site 0 stands for call sites that couldn't be interned
+    sitePages[0]=mapInternal(sizeof(callSite)<<M61_SITEPAGEBITS);
+    if(sitePages[0])
+        sitePages[0][0].file="?";
+    const char *env=getenv("M61_LEVEL");
+    if(env){
+        int i=0;
+        while(i<=M61_LEVELFULL&&strcmp(env,levelNames[i])!=0)
+            ++i;
+        if(i<=M61_LEVELFULL)
+            level=i;
+        else
+            fprintf(reportStream(),"WARNING: M61_LEVEL=%s is not one of off, counters, bounds, full; checking at level full\n",env);
+    }
+    env=getenv("M61_COMPACT");
+    if(env&&atoi(env)&&!compactDisabled&&level==M61_LEVELFULL){
+        records=mmap(NULL,M61_MAXSLOTS*sizeof(allocRecord),PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+        if(records!=MAP_FAILED)
+            compactMode=1;
+        else
+            records=NULL;
+    }
+    env=getenv("M61_THETA");
+    if(env&&strtod(env,NULL)>0&&strtod(env,NULL)<=100)
+        theta=strtod(env,NULL);
+    numberCounters=(int)(100/theta);
+    if(numberCounters<100/theta)
+        ++numberCounters;
+    env=getenv("M61_SAMPLE");
+    if(env&&strtod(env,NULL)>0&&level==M61_LEVELFULL)
+        sampleRate=strtod(env,NULL);
+    untrackedBlocks=sampleRate||level==M61_LEVELBOUNDS;
+    env=getenv("M61_GUARD");
+    if(env&&atol(env)>0&&level>=M61_LEVELBOUNDS)
+        guardThreshold=(size_t)atol(env);
+    env=getenv("M61_REDZONE");
+    if(env&&atol(env)>0&&level>=M61_LEVELBOUNDS){
+        redzoneSize=atol(env)<M61_MAXREDZONE?((size_t)atol(env)+15)&~(size_t)15:M61_MAXREDZONE;
+        trailerSize=sizeof(backpack)+redzoneSize;
+    }
+    env=getenv("M61_QUARANTINE");
+    if(env&&atol(env)>0&&level>=M61_LEVELBOUNDS)
+        quarantineBudget=(size_t)atol(env);
+    env=getenv("M61_TRACE");
+    if(env&&*env)
+        traceInit(env);
+    env=getenv("M61_STACKS");
+    if(env&&atoi(env)>0&&level==M61_LEVELFULL&&(stackPages[0]=mapInternal(sizeof(callStack)<<M61_STACKPAGEBITS)))
+        stackDepth=atoi(env)<M61_MAXFRAMES?atoi(env):M61_MAXFRAMES;
+    env=getenv("M61_CLOCK");
+#if defined(__x86_64__)||defined(__i386__)
+    if(env&&strcmp(env,"tsc")==0)
+        tscClock=1;
+#endif
+    env=getenv("M61_HISTOGRAMS");
+    if(env&&atoi(env))
+        printHistograms=siteStatistics=1;
+    env=getenv("M61_PEAKS");
+    if(env&&atoi(env))
+        printPeaks=siteStatistics=1;
+    env=getenv("M61_LEAKS");
+    if(env&&strcmp(env,"sites")==0)
+        leakSummary=1;
+    else if(env&&strcmp(env,"mark")==0)
+        leakSummary=2;
+    env=getenv("M61_TIMELINE_INTERVAL");
+    if(env&&atol(env)>0)
+        timelineInterval=atol(env);
+    env=getenv("M61_TIMELINE_ALLOCATIONS");
+    if(env&&atol(env)>0)
+        timelineAllocations=atol(env)<M61_CLOCKBATCH?M61_CLOCKBATCH:(uint32_t)atol(env);
+    env=getenv("M61_TIMELINE");
+    if(env&&*env)
+        timelineInit(env);
+    env=getenv("M61_STATS_INTERVAL");
+    if(env&&atol(env)>0)
+        statsInterval=atol(env);
+    env=getenv("M61_STATS");
+    if(env&&*env)
+        statsInit(env);
+    env=getenv("M61_SWEEP");
+    if(env&&atoi(env)>0&&level==M61_LEVELFULL){
+        sweepBudget=atoi(env)<100?atoi(env):100;
+        pthread_t thread;
+        if(!pthread_create(&thread,NULL,sweepThread,NULL))
+            pthread_detach(thread);
+    }
+    __atomic_store_n(&checks,&checkLevels[level],__ATOMIC_RELEASE);
+    __atomic_store_n(&m61Initialized,1,__ATOMIC_RELEASE);
+}
+
+FILE *reportStream(void){
+    return reportFile?reportFile:stdout;
+}
+
+//fork() takes every lock of m61 in the order in which they nest, so that the child doesn't inherit a lock held by a thread it doesn't have
+//shards that are added in the meantime are pushed in front of forkThreads, so the parent and the child unlock exactly the shards that were locked
+void forkPrepare(void){
+    pthread_mutex_lock(&statsLock);
+    pthread_mutex_lock(&timelineLock);
+    pthread_mutex_lock(&quarantineLock);
+    pthread_mutex_lock(&siteLock);
+    pthread_mutex_lock(&stackLock);
+    forkThreads=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);
+    for(threadState *t=forkThreads;t;t=t->next)
+        pthread_mutex_lock(&t->traceLock);
+    pthread_mutex_lock(&traceFileLock);
+    for(threadState *t=forkThreads;t;t=t->next)
+        pthread_mutex_lock(&t->lock);
+    for(int i=0;i<M61_NCLASSES;++i)
+        pthread_mutex_lock(&sizeClasses[i].lock);
+    pthread_mutex_lock(&heapLock);
+    pthread_mutex_lock(&peakLock);
+}
+
+//releases the locks of forkPrepare() in the parent and in the child
+void forkRelease(void){
+    pthread_mutex_unlock(&peakLock);
+    pthread_mutex_unlock(&heapLock);
+    for(int i=0;i<M61_NCLASSES;++i)
+        pthread_mutex_unlock(&sizeClasses[i].lock);
+    for(threadState *t=forkThreads;t;t=t->next)
+        pthread_mutex_unlock(&t->lock);
+    pthread_mutex_unlock(&traceFileLock);
+    for(threadState *t=forkThreads;t;t=t->next)
+        pthread_mutex_unlock(&t->traceLock);
+    pthread_mutex_unlock(&stackLock);
+    pthread_mutex_unlock(&siteLock);
+    pthread_mutex_unlock(&quarantineLock);
+    pthread_mutex_unlock(&timelineLock);
+    pthread_mutex_unlock(&statsLock);
+}
+
+//releases the locks in the child, which isn't traced: the trace file belongs to the parent, which goes on to reserve the same offsets
+//the buffered events of the parent are dropped, the parent writes them itself; the mapping goes away without cutting the file
+void forkChild(void){
+    forkRelease();
+    if(!__atomic_exchange_n(&tracing,0,__ATOMIC_ACQ_REL))
         return;
+    for(threadState *t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next)
+        t->traceUsed=0;
+    munmap(traceMap,M61_TRACEMAX);
+    close(traceFd);
+}
+
+//maps memory for m61's own tables, this memory is not part of the heap
+void *mapInternal(size_t len){
+    void *ptr=mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    return ptr==MAP_FAILED?NULL:ptr;
+}
+
+//returns zeroed memory for small internal structures, this memory is never given back
+void *allocateInternal(size_t len){
+    len=(len+15)&~(size_t)15;
+    pthread_mutex_lock(&heapLock);
+    if(internalNext+len>internalEnd){
+        size_t mapLen=len>M61_SLABSIZE?len:M61_SLABSIZE;
+        internalNext=mapInternal(mapLen);
+        internalEnd=internalNext?internalNext+mapLen:NULL;
+        if(!internalNext){
+            pthread_mutex_unlock(&heapLock);
+            return NULL;
+        }
     }
-    unsigned short int metadataIsValid=(meta_ptr==meta_ptr->self);
-    
-    backpack *backpack_ptr=(backpack *)((char *)ptr+meta_ptr->sz);    //construct backpack pointer
-    unsigned short int backpackIsValid=(backpack_ptr==backpack_ptr->self);
-   
+    void *ptr=internalNext;
+    internalNext+=len;
+    pthread_mutex_unlock(&heapLock);
+    return ptr;
+}
 
-    //If neither the metadata nor the backpack is intact, we assume that the pointer was not handed out by m61_malloc() 
-    if(!metadataIsValid&&!backpackIsValid){
-        printf("MEMORY BUG: %s:%i: invalid free of pointer %p, not allocated\n",file,line,ptr);
-        metadata *frontAlloc=scanMemoryForAllocation(meta_ptr);
-        uintptr_t offset=(char *)meta_ptr-(char *)frontAlloc;
-        if(frontAlloc!=NULL&&offset<sizeof(metadata)+frontAlloc->sz+sizeof(backpack)){
-            printf("  %s:%i: %p is %zu bytes inside a %zu byte region allocated here\n",frontAlloc->file,frontAlloc->line,ptr,(char *)meta_ptr-(char *)frontAlloc,frontAlloc->sz);
-            return;
+//returns the shard of the calling thread, a new thread takes over the shard of a thread that exited or gets a new one
+threadState *currentThread(void){
+    threadState *t=myThread;
+    if(t)
+        return t;
+    for(t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next){
+        int retired=1;
+        if(__atomic_load_n(&t->retired,__ATOMIC_RELAXED)&&__atomic_compare_exchange_n(&t->retired,&retired,0,0,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED))
+            break;
+    }
+    if(!t){
+        t=allocateInternal(sizeof(threadState));
+        if(!t)
+            abort();    //there is no way to report anything without a shard
+        pthread_mutex_init(&t->lock,NULL);
+        pthread_mutex_init(&t->traceLock,NULL);
+        t->id=__atomic_add_fetch(&nthreads,1,__ATOMIC_RELAXED);
+        t->random=(__atomic_add_fetch(&sampleSeed,1,__ATOMIC_RELAXED))*0x9e3779b97f4a7c15ULL;
+        if(sampleRate)
+            t->untilSample=(unsigned long long)(-log(1-sampleRandom(t))*sampleRate)+1;
+        t->next=__atomic_load_n(&threads,__ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&threads,&t->next,t,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED))
+            ;
+    }
+    t->thread=pthread_self();
+    t->mainThread=getpid()==(pid_t)syscall(SYS_gettid);
+    myThread=t;
+    pthread_setspecific(threadKey,t);
+    return t;
+}
+
+//called when a thread exits, its blocks stay in the shard's allocation list
+//another thread may adopt the shard right after, so a later key destructor of the exiting thread that allocates gets a shard of its own
+void retireThread(void *arg){
+    threadState *t=arg;
+    myThread=NULL;
+    drainRemoteFrees(t);
+    for(int i=0;i<M61_NCLASSES;++i)
+        flushCache(t,i,t->cached[i]);
+    flushActive(t);
+    pthread_mutex_lock(&t->traceLock);
+    traceDrain(t);
+    pthread_mutex_unlock(&t->traceLock);
+    __atomic_store_n(&t->retired,1,__ATOMIC_RELEASE);
+}
+
+//checks whether t is one of the shards, this is only needed when the metadata of a block can't be trusted
+int isThreadState(threadState *t){
+    for(threadState *it=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);it;it=it->next)
+        if(it==t)
+            return 1;
+    return 0;
+}
+
+//returns the call site with the given id
+callSite *siteAt(uint32_t id){
+    return &sitePages[id>>M61_SITEPAGEBITS][id&((1<<M61_SITEPAGEBITS)-1)];
+}
+
+uint32_t siteHash(const char *file, int line){
+    return (uint32_t)((uintptr_t)file>>3)*2654435761u^(uint32_t)line*40503u;
+}
+
+uint32_t siteNameHash(const char *file, int line){
+    uint32_t h=2166136261u;
+    for(const char *c=file?file:"";*c;++c)
+        h=(h^(unsigned char)*c)*16777619u;
+    return h^(uint32_t)line*40503u;
+}
+
+//returns the id of the site whose file name has the same contents as file, or a new id; called with siteLock held
+//compilers emit the name of a file once per translation unit (and once per inline function in a header), this merges them
+uint32_t siteByName(const char *file, int line){
+    uint32_t capacity=siteNames?siteNames[0]:0;
+    if((nsites+1)*2>capacity){
+        uint32_t grown=capacity?capacity*2:1024;
+        uint32_t *names=mapInternal((1+(size_t)grown)*sizeof(uint32_t));
+        if(!names||nsites+1>=M61_MAXSITES)
+            return 0;
+        names[0]=grown;
+        for(uint32_t i=0;i<capacity;++i){
+            if(!siteNames[1+i])
+                continue;
+            callSite *site=siteAt(siteNames[1+i]);
+            uint32_t h=siteNameHash(site->file,site->line)&(grown-1);
+            while(names[1+h])
+                h=(h+1)&(grown-1);
+            names[1+h]=siteNames[1+i];
         }
-        return;
+        if(siteNames)
+            munmap(siteNames,(1+(size_t)capacity)*sizeof(uint32_t));
+        siteNames=names;
+        capacity=grown;
     }
-    //this is basically an XOR since 1||1 will be caught by the AND above
-    //If one of metadata or backpack is not intact, we assume that a boundary write occured
-    if(!metadataIsValid||!backpackIsValid){
-        printf("MEMORY BUG: %s:%i: detected wild write during free of pointer %p\n",file,line,ptr);
-        printf("MEMORY BUG: %s:%i: boundary write error!\n",file,line);
+    uint32_t id;
+    uint32_t h=siteNameHash(file,line)&(capacity-1);
+    for(;(id=siteNames[1+h]);h=(h+1)&(capacity-1)){
+        callSite *site=siteAt(id);
+        if(site->line==line&&(site->file==file||(site->file&&file&&!strcmp(site->file,file))))
+            return id;
     }
-    
-   	--active_count;
-    size_t sz=meta_ptr->sz;
-   	active_size-=(unsigned long long)sz;
-   
-    //make metadata and backpack invalid 
-    meta_ptr->self=NULL;
-    backpack_ptr->self=NULL;
-    
-    meta_ptr->file=file;
-    meta_ptr->line=line;
-    meta_ptr->previously_freed=1;       //this will be checked on each call to m61_free() to catch double frees 
+    id=nsites+1;
+    callSite **page=&sitePages[id>>M61_SITEPAGEBITS];
+    if(!*page&&!(*page=mapInternal(sizeof(callSite)<<M61_SITEPAGEBITS)))
+        return 0;
+    siteAt(id)->file=file;
+    siteAt(id)->line=line;
+    siteNames[1+h]=id;
+    __atomic_store_n(&nsites,id,__ATOMIC_RELEASE);
+    return id;
+}
 
-    //Update of the doubly linked list 
-    metadata *prv=meta_ptr->prv;
-    metadata *next=meta_ptr->next;
-    if(next==NULL){
-        lastAlloc=prv;    
+//returns the id of the call site file:line, sites with the same line and file names with the same contents share their id
+//lookups by the address of the file name don't take a lock: entries are published by their id and old indexes stay mapped
+uint32_t siteIntern(const char *file, int line){
+    siteTable *index=__atomic_load_n(&siteIndex,__ATOMIC_ACQUIRE);
+    uint32_t id;
+    if(index){
+        uint32_t mask=index->capacity-1;
+        for(uint32_t h=siteHash(file,line)&mask;(id=__atomic_load_n(&index->entries[h].id,__ATOMIC_ACQUIRE));h=(h+1)&mask)
+            if(index->entries[h].file==file&&index->entries[h].line==line)
+                return id;
     }
-    if(prv!=NULL){
-        if(prv->next!=meta_ptr){
-            printf("MEMORY BUG%s:%i: invalid free of pointer %p",file,line,ptr);
-            return;
+    pthread_mutex_lock(&siteLock);
+    uint32_t capacity=siteIndex?siteIndex->capacity:0;
+    if((nentries+1)*2>capacity){
+        //rehash into a table twice as big, readers may still be probing the old one
+        uint32_t grown=capacity?capacity*2:1024;
+        index=mapInternal(sizeof(siteTable)+(size_t)grown*sizeof(siteEntry));
+        if(!index){
+            pthread_mutex_unlock(&siteLock);
+            return 0;
         }
-        prv->next=next;
-        if(next!=NULL){
-            next->prv=prv;
+        index->capacity=grown;
+        for(uint32_t i=0;i<capacity;++i){
+            siteEntry *entry=&siteIndex->entries[i];
+            if(!entry->id)
+                continue;
+            uint32_t h=siteHash(entry->file,entry->line)&(grown-1);
+            while(index->entries[h].id)
+                h=(h+1)&(grown-1);
+            index->entries[h]=*entry;
         }
-        else{
-            lastAlloc=prv;
-        } 
+        __atomic_store_n(&siteIndex,index,__ATOMIC_RELEASE);
+        capacity=grown;
     }
-    else{
-        if(next!=NULL){
-            next->prv=prv;
-        }
-        else{
-            lastAlloc=NULL;
+    uint32_t h=siteHash(file,line)&(capacity-1);
+    for(;(id=siteIndex->entries[h].id);h=(h+1)&(capacity-1)){
+        if(siteIndex->entries[h].file==file&&siteIndex->entries[h].line==line){
+            pthread_mutex_unlock(&siteLock);
+            return id;
         }
     }
-   	free(meta_ptr);
+    uint32_t known=nsites;
+    if(!(id=siteByName(file,line))){
+        pthread_mutex_unlock(&siteLock);
+        return 0;
+    }
+    siteIndex->entries[h].file=file;
+    siteIndex->entries[h].line=line;
+    ++nentries;
+    __atomic_store_n(&siteIndex->entries[h].id,id,__ATOMIC_RELEASE);
+    pthread_mutex_unlock(&siteLock);
+    if(id>known&&__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+        traceSite(id,file,line);
+    return id;
 }
 
-void *m61_realloc(void *ptr, size_t sz, const char *file, int line) {
-    (void) file, (void) line;	// avoid uninitialized variable warnings
-    void *new_ptr = NULL;
-    if (sz != 0)
-        new_ptr = m61_malloc(sz,file,line);
-    if (ptr != NULL && new_ptr != NULL) {
-            metadata *meta_ptr=getMetadata(ptr); 
-            size_t old_sz = meta_ptr->sz;
-            if (old_sz < sz)
-             memcpy(new_ptr, ptr, old_sz);
-        else
-             memcpy(new_ptr, ptr, sz);
+//interns the call site file:line and caches its id in *cache (unless cache is NULL), for M61_SITE()
+uint32_t m61_intern_site(uint32_t *cache, const char *file, int line){
+    if(!__atomic_load_n(&m61Initialized,__ATOMIC_ACQUIRE))
+        pthread_once(&initOnce,m61Init);
+    uint32_t id=siteIntern(file,line);
+    if(cache)
+        __atomic_store_n(cache,id,__ATOMIC_RELAXED);
+    return id;
+}
+
+//opens the trace file and maps it, the trace is closed by traceFinish() at exit
+void traceInit(const char *path){
+    traceFd=open(path,O_RDWR|O_CREAT|O_TRUNC,0644);
+    if(traceFd<0)
+        return;
+    traceMap=mmap(NULL,M61_TRACEMAX,PROT_READ|PROT_WRITE,MAP_SHARED,traceFd,0);
+    if(traceMap==MAP_FAILED||ftruncate(traceFd,M61_TRACEGROWTH)){
+        close(traceFd);
+        return;
     }
-    m61_free(ptr,file, line);
-    return new_ptr;
+    traceFileSize=M61_TRACEGROWTH;
+    memcpy(traceMap,"M61TRACE",8);
+    uint32_t version=M61_TRACE_VERSION, header=M61_TRACEHEADER;
+    memcpy(traceMap+8,&version,4);
+    memcpy(traceMap+12,&header,4);
+    traceOffset=M61_TRACEHEADER;
+    tracing=1;
+    atexit(traceFinish);
 }
 
-void *m61_calloc(size_t nmemb, size_t sz, const char *file, int line) {
-    (void) file, (void) line;	// avoid uninitialized variable warnings
-    if (sz>maximumSizeValid()/nmemb){
-        ++fail_count;
-	fail_size+=(unsigned long long)sz;
-        return NULL;
+//drains the trace buffers of all threads and cuts the trace file to the chunks that were written
+void traceFinish(void){
+    if(!__atomic_exchange_n(&tracing,0,__ATOMIC_ACQ_REL))
+        return;
+    for(threadState *t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next){
+        pthread_mutex_lock(&t->traceLock);
+        traceDrain(t);
+        pthread_mutex_unlock(&t->traceLock);
     }
-    void *ptr = m61_malloc(sz * nmemb, file, line);
-    if (ptr != NULL)
-	memset(ptr, 0, sz * nmemb);     // clear memory to 0
-    return ptr;
+    if(ftruncate(traceFd,traceOffset<=traceFileSize?traceOffset:traceFileSize)){}
+    munmap(traceMap,M61_TRACEMAX);
+    close(traceFd);
 }
 
-void m61_getstatistics(struct m61_statistics *stats) {
-    // Stub: set all statistics to 0
-    memset(stats, 0, sizeof(struct m61_statistics));
-	stats->total_count=total_count;
-	stats->total_size=total_size;
-	stats->active_size=active_size;
-	stats->active_count=active_count;
-	stats->fail_count=fail_count;
-	stats->fail_size=fail_size;
+unsigned long long traceClock(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return (unsigned long long)now.tv_sec*1000000000ULL+(unsigned long long)now.tv_nsec;
 }
 
-void m61_printstatistics(void) {
+//writes value as an unsigned LEB128 varint and returns the end of it
+unsigned char *putVarint(unsigned char *out, uint64_t value){
+    while(value>=0x80){
+        *out++=(unsigned char)(value|0x80);
+        value>>=7;
+    }
+    *out++=(unsigned char)value;
+    return out;
+}
+
+//writes the buffered events of the thread as one chunk into the trace file, called with the thread's traceLock held
+//chunks are reserved with an atomic add, so threads only serialize when the file has to grow
+void traceDrain(threadState *t){
+    if(!t->traceUsed)
+        return;
+    uint32_t len=(uint32_t)t->traceUsed;
+    size_t chunk=M61_TRACECHUNKHEADER+len;
+    t->traceUsed=0;
+    size_t offset=__atomic_fetch_add(&traceOffset,chunk,__ATOMIC_RELAXED);
+    if(offset+chunk>M61_TRACEMAX)
+        return;
+    if(offset+chunk>__atomic_load_n(&traceFileSize,__ATOMIC_ACQUIRE)){
+        pthread_mutex_lock(&traceFileLock);
+        size_t size=traceFileSize;
+        while(size<offset+chunk)
+            size+=size<M61_TRACEGROWTH?M61_TRACEGROWTH:size;
+        if(size>M61_TRACEMAX)
+            size=M61_TRACEMAX;
+        if(size!=traceFileSize&&!ftruncate(traceFd,size))
+            __atomic_store_n(&traceFileSize,size,__ATOMIC_RELEASE);
+        pthread_mutex_unlock(&traceFileLock);
+        if(offset+chunk>__atomic_load_n(&traceFileSize,__ATOMIC_ACQUIRE))
+            return;
+    }
+    char *out=traceMap+offset;
+    unsigned long long start=t->traceStart;
+    memcpy(out,&len,4);
+    memcpy(out+4,&t->id,4);
+    memcpy(out+8,&start,8);
+    memcpy(out+M61_TRACECHUNKHEADER,t->traceBuffer,len);
+}
+
+//appends an event to the trace buffer of the calling thread, newPtr is the result of a realloc; site is the id of file:line
+//(0 if the caller doesn't have it, it is interned then)
+//the buffer is drained first when it might not have room for the event
+void traceEvent(int op, const char *file, int line, size_t sz, void *ptr, void *newPtr, uint32_t site){
+    threadState *t=currentThread();
+    if(!site)
+        site=siteIntern(file,line);
+    pthread_mutex_lock(&t->traceLock);
+    if(!__atomic_load_n(&tracing,__ATOMIC_RELAXED)){
+        pthread_mutex_unlock(&t->traceLock);
+        return;
+    }
+    if(!t->traceBuffer&&!(t->traceBuffer=mapInternal(M61_TRACEBUFFER))){
+        pthread_mutex_unlock(&t->traceLock);
+        return;
+    }
+    unsigned long long now=traceClock();
+    if(t->traceUsed+M61_TRACEEVENT>M61_TRACEBUFFER)
+        traceDrain(t);
+    if(!t->traceUsed)
+        t->traceStart=t->traceTime=now;
+    unsigned char *out=t->traceBuffer+t->traceUsed;
+    *out++=(unsigned char)op;
+    out=putVarint(out,now-t->traceTime);
+    out=putVarint(out,site);
+    if(op!=M61_TRACE_FREE)
+        out=putVarint(out,sz);
+    out=putVarint(out,(uintptr_t)ptr>>3);
+    if(op==M61_TRACE_REALLOC)
+        out=putVarint(out,(uintptr_t)newPtr>>3);
+    t->traceTime=now;
+    t->traceUsed=out-t->traceBuffer;
+    pthread_mutex_unlock(&t->traceLock);
+}
+
+//appends the definition of a new call site to the trace buffer of the calling thread
+void traceSite(uint32_t id, const char *file, int line){
+    threadState *t=currentThread();
+    size_t len=strlen(file);
+    if(len>M61_TRACEFILENAME)
+        len=M61_TRACEFILENAME;
+    pthread_mutex_lock(&t->traceLock);
+    if(!t->traceBuffer&&!(t->traceBuffer=mapInternal(M61_TRACEBUFFER))){
+        pthread_mutex_unlock(&t->traceLock);
+        return;
+    }
+    if(t->traceUsed+M61_TRACEEVENT+len>M61_TRACEBUFFER)
+        traceDrain(t);
+    if(!t->traceUsed)
+        t->traceStart=t->traceTime=traceClock();
+    unsigned char *out=t->traceBuffer+t->traceUsed;
+    *out++=M61_TRACE_SITE;
+    out=putVarint(out,id);
+    out=putVarint(out,(uint64_t)(unsigned)line);
+    out=putVarint(out,len);
+    memcpy(out,file,len);
+    t->traceUsed=out+len-t->traceBuffer;
+    pthread_mutex_unlock(&t->traceLock);
+}
+
+//creates the shared statistics page and starts the thread that rewrites it, the page is removed by statsFinish() at exit
+void statsInit(const char *name){
+    if(strcmp(name,"1")==0)
+        snprintf(statsName,sizeof(statsName),"/m61.%d",(int)getpid());
+    else
+        snprintf(statsName,sizeof(statsName),"%s%s",name[0]=='/'?"":"/",name);
+    int fd=shm_open(statsName,O_RDWR|O_CREAT|O_TRUNC,0644);
+    if(fd<0)
+        return;
+    struct m61_stats_page *page=MAP_FAILED;
+    if(!ftruncate(fd,sizeof(struct m61_stats_page)))
+        page=mmap(NULL,sizeof(struct m61_stats_page),PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if(page==MAP_FAILED){
+        shm_unlink(statsName);
+        return;
+    }
+    memcpy(page->magic,M61_STATS_MAGIC,8);
+    page->version=M61_STATS_VERSION;
+    page->pid=(uint32_t)getpid();
+    statsPid=getpid();
+    statsPage=page;
+    pthread_t thread;
+    if(!pthread_create(&thread,NULL,statsThread,NULL))
+        pthread_detach(thread);
+    atexit(statsFinish);
+}
+
+void *statsThread(void *arg){
+    (void) arg;
+    struct timespec interval={statsInterval/1000,statsInterval%1000*1000000};
+    for(;;){
+        publishStats();
+        nanosleep(&interval,NULL);
+    }
+    return NULL;
+}
+
+//merges the shards and writes them into the page, the sequence is odd while the page is written so that readers can retry
+void publishStats(void){
+    pthread_mutex_lock(&statsLock);
+    struct m61_stats_page *page=statsPage;
+    if(!page){
+        pthread_mutex_unlock(&statsLock);
+        return;
+    }
     struct m61_statistics stats;
     m61_getstatistics(&stats);
+    struct m61_histograms histograms;
+    m61_gethistograms(&histograms,NULL,0);
+    int freqElements=0, szElements=0;
+    hitTracker *freqTracker=stats.total_count?mergeHitTrackers(0,&freqElements):NULL;
+    hitTracker *szTracker=stats.total_count?mergeHitTrackers(1,&szElements):NULL;
 
-    printf("malloc count: active %10llu   total %10llu   fail %10llu\n\
-malloc size:  active %10llu   total %10llu   fail %10llu\n",
-    stats.active_count, stats.total_count, stats.fail_count,
-    stats.active_size, stats.total_size, stats.fail_size);
+    uint64_t sequence=page->sequence;
+    __atomic_store_n(&page->sequence,sequence+1,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    page->updates++;
+    page->time=traceClock();
+    page->stats=stats;
+    //the open batches of the threads aren't in the peaks yet, but the active counters summed from the shards are
+    page->peak_count=__atomic_load_n(&peaks.count,__ATOMIC_RELAXED);
+    page->peak_count=page->peak_count<stats.active_count?stats.active_count:page->peak_count;
+    page->peak_size=__atomic_load_n(&peaks.size,__ATOMIC_RELAXED);
+    page->peak_size=page->peak_size<stats.active_size?stats.active_size:page->peak_size;
+    memcpy(page->size_histogram,histograms.size,sizeof(histograms.size));
+    memcpy(page->lifetime_histogram,histograms.lifetime,sizeof(histograms.lifetime));
+    page->nfrequent=freqTracker?publishHitters(page->frequent,freqTracker,freqElements):0;
+    page->nbig=szTracker?publishHitters(page->big,szTracker,szElements):0;
+    __atomic_store_n(&page->sequence,sequence+2,__ATOMIC_RELEASE);
+    pthread_mutex_unlock(&statsLock);
+
+    if(freqTracker)
+        munmap(freqTracker,freqElements?freqElements*sizeof(hitTracker):1);
+    if(szTracker)
+        munmap(szTracker,szElements?szElements*sizeof(hitTracker):1);
+}
+
+//copies the biggest merged counters into the page and returns how many there are
+uint32_t publishHitters(struct m61_stats_site *sites, hitTracker *merged, int elements){
+    uint32_t n=0;
+    for(;n<M61_STATS_SITES&&(int)n<elements;++n){
+        callSite *site=keySite(merged[n].site);
+        snprintf(sites[n].file,M61_STATS_SITENAME,"%s",site->file);
+        sites[n].line=site->line;
+        sites[n].count=merged[n].counter;
+        sites[n].error=merged[n].error;
+    }
+    return n;
 }
 
-void leakTraverse(metadata *ptr){
-    if(ptr)
-        printf("LEAK CHECK: %s:%d: allocated object %p with size %zu\n",ptr->file,ptr->line,getPayload(ptr),ptr->sz);
-    if(ptr->prv)
-        leakTraverse(ptr->prv);
-   return; 
+//writes the final statistics and removes the page, readers that have it mapped keep the last update
+void statsFinish(void){
+    if(getpid()!=statsPid)
+        return;
+    publishStats();
+    shm_unlink(statsName);
 }
 
-void m61_printleakreport(void) {
-  //if allocated objects exist, start recursive traversal of the list of Allocations 
-  if(lastAlloc)
-      leakTraverse(lastAlloc); 
+//opens the timeline file, snapshots are taken by a thread every timelineInterval milliseconds or while allocating every timelineAllocations
+//allocations; the last snapshot is taken at exit
+void timelineInit(const char *path){
+    timelineFd=open(path,O_WRONLY|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC,0644);
+    if(timelineFd<0)
+        return;
+    siteStatistics=1;
+    timelineStart=traceClock();
+    timelinePid=getpid();
+    pthread_t thread;
+    if(!timelineAllocations&&!pthread_create(&thread,NULL,timelineThread,NULL))
+        pthread_detach(thread);
+    atexit(timelineSnapshot);
 }
 
-void printHeavyHitterReport(void){
-    sortHitTracker(szTracker,NUMBERCOUNTERS);
-    sortHitTracker(freqTracker,NUMBERCOUNTERS);
-    
-    unsigned long long freqCounterSum=0;
-    unsigned long long szCounterSum=0;
-    for(int i=0;i<NUMBERCOUNTERS;++i){
-        freqCounterSum+=freqTracker[i].counter;
-        szCounterSum+=szTracker[i].counter;   
+void *timelineThread(void *arg){
+    (void) arg;
+    struct timespec interval={timelineInterval/1000,timelineInterval%1000*1000000};
+    for(;;){
+        nanosleep(&interval,NULL);
+        timelineSnapshot();
     }
+    return NULL;
+}
 
-    printf("---------------Heavy Hitter Report-----------------\n");
-    for(int i=0;i<NUMBERCOUNTERS;++i){
-        if(freqTracker[i].counter<0.05*total_count) continue;
-        unsigned long long count=freqTracker[i].counter+(total_count-freqCounterSum)/(NUMBERCOUNTERS+1);
-        printf("HEAVY HITTER: %s:%d: %llu allocations (~%d%%)\n",freqTracker[i].file,freqTracker[i].line,count,(int)(count*100/total_count));
+//appends a line to the timeline: milliseconds since the start, active allocations, active bytes and the call sites with the most active bytes
+//as file:line=bytes; nothing in here allocates, so it can be called from within an allocation
+void timelineSnapshot(void){
+    if(timelineFd<0||getpid()!=timelinePid)
+        return;
+    struct m61_statistics stats;
+    m61_getstatistics(&stats);
+    uint32_t top[M61_TIMELINESITES];
+    unsigned long long topSize[M61_TIMELINESITES];
+    int ntop=0;
+    uint32_t sites=__atomic_load_n(&nsites,__ATOMIC_ACQUIRE);
+    for(uint32_t id=1;id<=sites;++id){
+        siteStats *page=__atomic_load_n(&siteStatsPages[id>>M61_SITEPAGEBITS],__ATOMIC_ACQUIRE);
+        if(!page){
+            id|=(1<<M61_SITEPAGEBITS)-1;
+            continue;
+        }
+        unsigned long long size=__atomic_load_n(&page[id&((1<<M61_SITEPAGEBITS)-1)].active_size,__ATOMIC_RELAXED);
+        if(!size||(ntop==M61_TIMELINESITES&&size<=topSize[ntop-1]))
+            continue;
+        int pos=ntop<M61_TIMELINESITES?ntop++:ntop-1;
+        for(;pos>0&&topSize[pos-1]<size;--pos){
+            top[pos]=top[pos-1];
+            topSize[pos]=topSize[pos-1];
+        }
+        top[pos]=id;
+        topSize[pos]=size;
     }
-    for(int i=0;i<NUMBERCOUNTERS;++i){
-        if(szTracker[i].counter<0.05*total_size) continue;
-        unsigned long long count=szTracker[i].counter+(total_size-szCounterSum)/(NUMBERCOUNTERS+1);
-        printf("HEAVY HITTER: %s:%d: %llu bytes (~%d%%)\n",szTracker[i].file,szTracker[i].line,count,(int)(count*100/total_size));
+    char line[M61_TIMELINELINE];
+    int len=snprintf(line,sizeof(line),"%llu %llu %llu",(traceClock()-timelineStart)/1000000,stats.active_count,stats.active_size);
+    for(int i=0;i<ntop;++i){
+        callSite *site=siteAt(top[i]);
+        int n=snprintf(line+len,sizeof(line)-len-1," %s:%d=%llu",site->file,site->line,topSize[i]);
+        if(n<0||n>=(int)sizeof(line)-len-1)
+            break;
+        len+=n;
     }
-    printf("---------------------------------------------------\n");
+    line[len++]='\n';
+    pthread_mutex_lock(&timelineLock);
+    if(write(timelineFd,line,len)){}
+    pthread_mutex_unlock(&timelineLock);
 }
 
-//wrapper function which initializes the memory for the hitTracker structs and passes them to updateCounters
-void trackAllocByHH(size_t sz, const char *file, int line){
-    if(!szTracker){
-        szTracker=malloc(NUMBERCOUNTERS*sizeof(hitTracker));
-        freqTracker=malloc(NUMBERCOUNTERS*sizeof(hitTracker));
-        memset(szTracker,0,NUMBERCOUNTERS*sizeof(hitTracker));
-        memset(szTracker,0,NUMBERCOUNTERS*sizeof(hitTracker));
+//walks the frame pointer chain that starts at frame (the frame of the m61 function the user called) and stores up to stackDepth return addresses
+//like gperftools' strict unwinding, the walk ends at a null return address or at a saved frame pointer that doesn't lead a little way up the stack,
+//which is what code without frame pointers leaves behind
+int captureStack(void **frame, void **frames){
+    int depth=0;
+    while(depth<stackDepth&&frame[1]){
+        frames[depth++]=frame[1];
+        void **next=frame[0];
+        if(next<=frame||(char *)next-(char *)frame>M61_MAXFRAMESIZE||(uintptr_t)next%sizeof(void *))
+            break;
+#ifdef __GLIBC__
+        if((void *)frame<__libc_stack_end&&(void *)(next+2)>__libc_stack_end)
+            break;
+#endif
+        frame=next;
     }
-    updateCounters(szTracker,NUMBERCOUNTERS,sz,file,line); 
-    updateCounters(freqTracker,NUMBERCOUNTERS,1,file,line); 
+    return depth;
 }
 
-//modified implementation of the algorithm "FREQUENT" which doesn't rely on differential encoding
-//a pointer to an array of hitTracker structs is passed in along with the occurence which is either 1 (for count) or the size
-void updateCounters(hitTracker *tracker, int elements, size_t occurrence, const char *file, int line){
-    unsigned long long minimumValue;
-    minimumValue=(unsigned long long)-1;    //We keep track of the minimum count in the array in order to prevent an overflow from happening
-    unsigned long long subtractValue;
-    for(int i=0;i<elements;++i){
-        if(tracker[i].counter<minimumValue)
-            minimumValue=tracker[i].counter;
-        if(tracker[i].file==file&&tracker[i].line==line){
-            tracker[i].counter+=occurrence;
-            return;
+//returns the call stack with the given id
+callStack *stackAt(uint32_t id){
+    return &stackPages[id>>M61_STACKPAGEBITS][id&((1<<M61_STACKPAGEBITS)-1)];
+}
+
+uint32_t stackHash(uint32_t site, void **frames, int depth){
+    uint32_t h=site*2654435761u;
+    for(int i=0;i<depth;++i)
+        h=(h^(uint32_t)((uintptr_t)frames[i]>>2))*40503u+(uint32_t)i;
+    return h;
+}
+
+//returns the id of the call stack, stacks are looked up and added the same way as call sites in siteIntern()
+uint32_t stackIntern(uint32_t site, void **frames, int depth){
+    uint32_t hash=stackHash(site,frames,depth);
+    uint32_t *index=__atomic_load_n(&stackIndex,__ATOMIC_ACQUIRE);
+    uint32_t id;
+    if(index){
+        uint32_t mask=index[0]-1;
+        for(uint32_t h=hash&mask;(id=__atomic_load_n(&index[1+h],__ATOMIC_ACQUIRE));h=(h+1)&mask){
+            callStack *stack=stackAt(id);
+            if(stack->site==site&&stack->depth==(uint32_t)depth&&!memcmp(stack->frames,frames,depth*sizeof(void *)))
+                return id;
         }
-        else if(tracker[i].counter==0){
-            tracker[i].file=file;
-            tracker[i].line=line;
-            tracker[i].counter+=occurrence;
-            return;
+    }
+    pthread_mutex_lock(&stackLock);
+    uint32_t capacity=stackIndex?stackIndex[0]:0;
+    if((nstacks+1)*2>capacity){
+        uint32_t grown=capacity?capacity*2:1024;
+        index=mapInternal((1+(size_t)grown)*sizeof(uint32_t));
+        if(!index||nstacks+1>=M61_MAXSTACKS){
+            pthread_mutex_unlock(&stackLock);
+            return 0;
+        }
+        index[0]=grown;
+        for(uint32_t i=0;i<capacity;++i){
+            if(!stackIndex[1+i])
+                continue;
+            callStack *stack=stackAt(stackIndex[1+i]);
+            uint32_t h=stackHash(stack->site,stack->frames,stack->depth)&(grown-1);
+            while(index[1+h])
+                h=(h+1)&(grown-1);
+            index[1+h]=stackIndex[1+i];
+        }
+        __atomic_store_n(&stackIndex,index,__ATOMIC_RELEASE);
+        capacity=grown;
+    }
+    uint32_t h=hash&(capacity-1);
+    for(;(id=stackIndex[1+h]);h=(h+1)&(capacity-1)){
+        callStack *stack=stackAt(id);
+        if(stack->site==site&&stack->depth==(uint32_t)depth&&!memcmp(stack->frames,frames,depth*sizeof(void *))){
+            pthread_mutex_unlock(&stackLock);
+            return id;
         }
     }
-    if(occurrence>minimumValue)         //occurence>minimumValue would lead to an underflow of (at least) the smallest item in the array
-        subtractValue=minimumValue;
+    id=nstacks+1;
+    callStack **page=&stackPages[id>>M61_STACKPAGEBITS];
+    if(!*page&&!(*page=mapInternal(sizeof(callStack)<<M61_STACKPAGEBITS))){
+        pthread_mutex_unlock(&stackLock);
+        return 0;
+    }
+    callStack *stack=stackAt(id);
+    stack->site=site;
+    stack->depth=depth;
+    memcpy(stack->frames,frames,depth*sizeof(void *));
+    nstacks=id;
+    __atomic_store_n(&stackIndex[1+h],id,__ATOMIC_RELEASE);
+    pthread_mutex_unlock(&stackLock);
+    return id;
+}
+
+//returns the key that the heavy hitter trackers count an allocation under: the id of its call stack in stack mode, its call site otherwise
+uint32_t trackingKey(uint32_t site, void **frame){
+    if(!stackDepth)
+        return site;
+    void *frames[M61_MAXFRAMES];
+    int depth=captureStack(frame,frames);
+    return stackIntern(site,frames,depth);
+}
+
+//returns the id of the call site of a key of the heavy hitter trackers
+uint32_t keySiteId(uint32_t key){
+    return stackDepth?stackAt(key)->site:key;
+}
+
+callSite *keySite(uint32_t key){
+    return siteAt(keySiteId(key));
+}
+
+//prints the frames of the call stack of a key, symbolized as far as the dynamic symbol tables allow
+void printStack(uint32_t key){
+    if(!stackDepth)
+        return;
+    callStack *stack=stackAt(key);
+    for(uint32_t i=0;i<stack->depth;++i){
+        Dl_info info;
+        void *address=stack->frames[i];
+        if(dladdr(address,&info)&&info.dli_sname)
+            fprintf(reportStream(),"  #%u %p %s+0x%tx (%s)\n",i,address,info.dli_sname,(char *)address-(char *)info.dli_saddr,info.dli_fname);
+        else if(dladdr(address,&info))
+            fprintf(reportStream(),"  #%u %p (%s+0x%tx)\n",i,address,info.dli_fname,(char *)address-(char *)info.dli_fbase);
+        else
+            fprintf(reportStream(),"  #%u %p\n",i,address);
+    }
+}
+
+//creates a descriptor for the span and enters it into the page map, called with heapLock held
+span *newSpan(char *start, size_t len, size_t blocksz){
+    span *s=spareSpans;
+    if(!s){
+        //descriptors are never unmapped, they are recycled through the free list
+        size_t n=M61_SLABSIZE/sizeof(span);
+        s=mapInternal(n*sizeof(span));
+        if(!s)
+            return NULL;
+        for(size_t i=1;i<n-1;++i)
+            s[i].next=&s[i+1];
+        spareSpans=n>1?&s[1]:NULL;
+    }
     else
-        subtractValue=occurrence;
-    for(int i=0;i<elements;++i){
-        tracker[i].counter-=subtractValue;
+        spareSpans=s->next;
+    uintptr_t first=(uintptr_t)start>>M61_PAGESHIFT;
+    uintptr_t last=((uintptr_t)start+len-1)>>M61_PAGESHIFT;
+    for(uintptr_t page=first;page<=last;++page){
+        span **leaf=pageMap[page>>M61_LEAFBITS];
+        if(!leaf){
+            leaf=mapInternal(sizeof(span *)<<M61_LEAFBITS);
+            if(!leaf){
+                for(uintptr_t p=first;p<page;++p)
+                    pageMap[p>>M61_LEAFBITS][p&((1<<M61_LEAFBITS)-1)]=NULL;
+                s->next=spareSpans;
+                spareSpans=s;
+                return NULL;
+            }
+            __atomic_store_n(&pageMap[page>>M61_LEAFBITS],leaf,__ATOMIC_RELEASE);
+        }
+        if(page==first){
+            //the descriptor has to be complete before other threads can find it
+            s->start=start;
+            s->len=len;
+            s->blocksz=blocksz;
+            s->block=start;
+            s->guarded=0;
+            s->arena=NULL;
+            s->next=NULL;
+        }
+        __atomic_store_n(&leaf[page&((1<<M61_LEAFBITS)-1)],s,__ATOMIC_RELEASE);
     }
-    if(occurrence>minimumValue)
-       updateCounters(tracker,elements,occurrence-minimumValue,file,line);  //recursive call to make up for the difference of occurence and subtractValue
+    return s;
 }
 
+//removes the span from the page map and recycles its descriptor, called with heapLock held
+void deleteSpan(span *s){
+    uintptr_t first=(uintptr_t)s->start>>M61_PAGESHIFT;
+    uintptr_t last=((uintptr_t)s->start+s->len-1)>>M61_PAGESHIFT;
+    for(uintptr_t page=first;page<=last;++page)
+        __atomic_store_n(&pageMap[page>>M61_LEAFBITS][page&((1<<M61_LEAFBITS)-1)],NULL,__ATOMIC_RELEASE);
+    s->next=spareSpans;
+    spareSpans=s;
+}
 
-//sort the Array of Counters by count (bubblesort, but the cost should be negligible due to small n(1/theta) and the fact that it's only called twice
-void sortHitTracker(hitTracker *tracker, int elements){
-    int sorted;
-    sorted=0;
-    while(!sorted){
-        sorted=1;
-        for(int i=0;i<elements-1;++i){
-            if(tracker[i].counter<tracker[i+1].counter){ 
-                hitTracker tempTracker;
-                tempTracker=tracker[i];
-                tracker[i]=tracker[i+1];
-                tracker[i+1]=tempTracker;
-                sorted=0;
+//returns the start of the block of span s that contains ptr, or NULL if ptr is in the unused tail of a slab
+char *blockContaining(span *s, void *ptr){
+    if(!s->blocksz)
+        return s->block;
+    size_t offset=((char *)ptr-s->start)/s->blocksz*s->blocksz;
+    if(offset+s->blocksz>s->len)
+        return NULL;
+    return s->start+offset;
+}
+
+//Size classes are multiples of 16 bytes up to 256 bytes, above that there are four classes per power of two
+//returns the index of the smallest size class that fits a block of blocksz bytes
+int sizeClassIndex(size_t blocksz){
+    if(blocksz<=256)
+        return (int)((blocksz+15)>>4)-1;
+    int lg=63-__builtin_clzll((unsigned long long)(blocksz-1));
+    return 16+(lg-8)*4+(int)(((blocksz-1)>>(lg-2))-4);
+}
+
+//returns the size of the blocks in the size class with the given index
+size_t sizeClassBlockSize(int index){
+    if(index<16)
+        return (size_t)(index+1)<<4;
+    int lg=8+(index-16)/4;
+    return (size_t)((index-16)%4+5)<<(lg-2);
+}
+
+//maps len bytes of fresh (zeroed) memory for the heap
+void *mapMemory(size_t len){
+    char *ptr=mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    return ptr==MAP_FAILED?NULL:ptr;
+}
+
+//returns the length of the mapping that holds a large block
+size_t largeMappingSize(size_t blocksz){
+    return (blocksz+pageSize-1)&~(pageSize-1);
+}
+
+//returns the bucket of the large cache for a mapping of len bytes: its number of pages, or M61_LARGEEXACT plus the log2 of that
+//for mappings of M61_LARGEEXACT pages and more
+int largeBucket(size_t len){
+    size_t pages=len/pageSize;
+    if(pages<M61_LARGEEXACT)
+        return (int)pages;
+    return M61_LARGEEXACT+(63-__builtin_clzll((unsigned long long)pages))-(63-__builtin_clzll((unsigned long long)M61_LARGEEXACT));
+}
+
+//hands a new slab to the size class, a new chunk is mapped if the current one is used up
+//called with the lock of the class held
+int refillSlab(sizeClass *cls, int index){
+    pthread_mutex_lock(&heapLock);
+    if(chunkNext==chunkEnd){
+        char *chunk=mapMemory(M61_CHUNKSIZE);
+        if(!chunk){
+            pthread_mutex_unlock(&heapLock);
+            return 0;
+        }
+        chunkNext=chunk;
+        chunkEnd=chunk+M61_CHUNKSIZE;
+    }
+    span *slab=newSpan(chunkNext,M61_SLABSIZE,sizeClassBlockSize(index));
+    if(!slab){
+        pthread_mutex_unlock(&heapLock);
+        return 0;
+    }
+    slab->next=slabs;
+    __atomic_store_n(&slabs,slab,__ATOMIC_RELEASE);
+    cls->blocksz=slab->blocksz;
+    cls->bump=chunkNext;
+    cls->slabEnd=chunkNext+(M61_SLABSIZE/cls->blocksz)*cls->blocksz;
+    chunkNext+=M61_SLABSIZE;
+    pthread_mutex_unlock(&heapLock);
+    return 1;
+}
+
+//returns memory for a block of blocksz bytes (header, payload and backpack)
+//small blocks come from the free list or the current slab of their size class, large blocks are mapped on their own
+void *allocateBlock(size_t blocksz){
+    if(blocksz>M61_MAXCLASS){
+        if(blocksz>(size_t)-1-pageSize)
+            return NULL;
+        size_t len=largeMappingSize(blocksz);
+        //only the first mapping of the bucket of len is looked at: a short mapping has exactly that length, a longer one is at most twice as
+        //long (or too short, a new mapping is made then); a mapping much longer than the block would fault in the page of its backpack
+        //a block that realloc() moves is likely to grow on, it takes the first mapping of a later bucket (up to 16 times as long) as slack
+        int bucket=largeBucket(len);
+        int last=myThread&&myThread->growing&&len<=((size_t)-1)/16?largeBucket(len*16):bucket;
+        pthread_mutex_lock(&heapLock);
+        for(int i=bucket;i<=last;++i){
+            metadata *meta_ptr=largeCache[i];
+            size_t cachedLen=meta_ptr?addressIsInHeap(meta_ptr)->len:0;
+            if(cachedLen>=len){
+                largeCache[i]=meta_ptr->next;
+                largeCacheSize-=cachedLen;
+                pthread_mutex_unlock(&heapLock);
+                return meta_ptr;
             }
         }
+        pthread_mutex_unlock(&heapLock);
+        char *ptr=mapMemory(len);
+        if(!ptr)
+            return NULL;
+        pthread_mutex_lock(&heapLock);
+        span *s=newSpan(ptr,len,0);
+        pthread_mutex_unlock(&heapLock);
+        if(!s){
+            munmap(ptr,len);
+            return NULL;
+        }
+        return ptr;
+    }
+    int index=sizeClassIndex(blocksz);
+    threadState *t=cachingThread();
+    if(t){
+        void **block=t->cache[index];
+        if(!block){
+            if(!refillCache(t,index))
+                return NULL;
+            block=t->cache[index];
+        }
+        t->cache[index]=block[1];
+        --t->cached[index];
+        return block;
+    }
+    sizeClass *cls=&sizeClasses[index];
+    pthread_mutex_lock(&cls->lock);
+    void **block=cls->freeList;
+    if(block)
+        cls->freeList=block[1];
+    else if(cls->bump!=cls->slabEnd||refillSlab(cls,index)){
+        block=(void **)cls->bump;
+        cls->bump+=cls->blocksz;
     }
+    pthread_mutex_unlock(&cls->lock);
+    return block;
+}
+
+//returns a block to its size class, large blocks are cached for reuse or unmapped once the cache is full
+//the header is left intact (besides the next pointer) so that double frees can be reported
+void freeBlock(void *block, size_t blocksz){
+    if(blocksz>M61_MAXCLASS){
+        metadata *meta_ptr=block;
+        pthread_mutex_lock(&heapLock);
+        //the mapping of an aligned block doesn't start at the block, it isn't cached
+        span *s=addressIsInHeap(meta_ptr);
+        size_t len=s->len;
+        if(largeCacheSize+len>M61_LARGECACHE||s->block!=s->start){
+            char *start=s->start;
+            deleteSpan(s);
+            pthread_mutex_unlock(&heapLock);
+            munmap(start,len);
+            return;
+        }
+        meta_ptr->next=largeCache[largeBucket(len)];
+        largeCache[largeBucket(len)]=meta_ptr;
+        largeCacheSize+=len;
+        pthread_mutex_unlock(&heapLock);
+        return;
+    }
+    int index=sizeClassIndex(blocksz);
+    threadState *t=cachingThread();
+    if(t){
+        if(t->cached[index]==M61_TCACHEDEPTH)
+            flushCache(t,index,M61_TCACHEBATCH);
+        ((void **)block)[1]=t->cache[index];
+        t->cache[index]=block;
+        ++t->cached[index];
+        return;
+    }
+    sizeClass *cls=&sizeClasses[index];
+    pthread_mutex_lock(&cls->lock);
+    ((void **)block)[1]=cls->freeList;
+    cls->freeList=block;
+    pthread_mutex_unlock(&cls->lock);
+}
+
+//returns the shard whose cache the calling thread may use, NULL once the thread exited (or before it has a shard)
+threadState *cachingThread(void){
+    threadState *t=myThread;
+    return t&&!__atomic_load_n(&t->retired,__ATOMIC_RELAXED)?t:NULL;
+}
+
+//moves up to M61_TCACHEBATCH blocks of the size class into the empty cache of the thread under a single lock of the class
+//returns 0 if not even one block could be found
+int refillCache(threadState *t, int index){
+    sizeClass *cls=&sizeClasses[index];
+    pthread_mutex_lock(&cls->lock);
+    uint32_t n=0;
+    for(;n<M61_TCACHEBATCH;++n){
+        void **block=cls->freeList;
+        if(block)
+            cls->freeList=block[1];
+        else if(cls->bump!=cls->slabEnd||refillSlab(cls,index)){
+            block=(void **)cls->bump;
+            cls->bump+=cls->blocksz;
+        }
+        else
+            break;
+        block[1]=t->cache[index];
+        t->cache[index]=block;
+    }
+    pthread_mutex_unlock(&cls->lock);
+    t->cached[index]+=n;
+    return n>0;
+}
+
+//gives the first n blocks of the cache of the thread back to the free list of the size class under a single lock of the class
+void flushCache(threadState *t, int index, uint32_t n){
+    if(!n)
+        return;
+    void **first=t->cache[index],**last=first;
+    for(uint32_t i=1;i<n;++i)
+        last=last[1];
+    t->cache[index]=last[1];
+    t->cached[index]-=n;
+    sizeClass *cls=&sizeClasses[index];
+    pthread_mutex_lock(&cls->lock);
+    last[1]=cls->freeList;
+    cls->freeList=first;
+    pthread_mutex_unlock(&cls->lock);
+}
+
+//guarded blocks are given to allocations of at least guardThreshold bytes (in every mode)
+int isGuardedSize(size_t sz){
+    return guardThreshold&&sz>=guardThreshold;
+}
+
+//returns the length of the mapping of a guarded block with a payload of sz bytes: the pages for the metadata and the payload, and the guard page
+//an alignment above the page size can't be had by rounding, it takes up to alignment-1 bytes of room in front of the payload instead
+size_t guardedMappingSize(size_t sz, size_t alignment){
+    size_t payload=alignment>pageSize?sz+alignment-1:(sz+alignment-1)&~(alignment-1);
+    return ((sizeof(metadata)+payload+pageSize-1)&~(pageSize-1))+pageSize;
+}
+
+//maps a block whose payload ends right at a PROT_NONE guard page (rounded up to the alignment, at least M61_GUARDALIGN),
+//so that an overrun faults at the instruction; the metadata sits in front of the payload, on the first page of the mapping
+metadata *allocateGuarded(size_t sz, size_t alignment){
+    if(sz>(size_t)-1-sizeof(metadata)-2*pageSize-alignment)
+        return NULL;
+    size_t len=guardedMappingSize(sz,alignment);
+    char *start=mapMemory(len);
+    if(!start)
+        return NULL;
+    char *guard=start+len-pageSize;
+    if(mprotect(guard,pageSize,PROT_NONE)){
+        munmap(start,len);
+        return NULL;
+    }
+    metadata *meta_ptr=(metadata *)((uintptr_t)(guard-sz)&~(uintptr_t)(alignment-1))-1;
+    pthread_mutex_lock(&heapLock);
+    span *s=newSpan(start,len,0);
+    if(s){
+        s->block=(char *)meta_ptr;
+        s->guarded=1;
+    }
+    pthread_mutex_unlock(&heapLock);
+    if(!s){
+        munmap(start,len);
+        return NULL;
+    }
+    return meta_ptr;
+}
+
+//freed guarded blocks stay mapped (with their metadata for double free reports) and are unmapped M61_GUARDBATCH at a time
+void retireGuarded(span *s){
+    char *starts[M61_GUARDBATCH];
+    size_t lens[M61_GUARDBATCH];
+    int n=0;
+    pthread_mutex_lock(&heapLock);
+    s->next=guardPending;
+    guardPending=s;
+    if(++guardPendingCount>=M61_GUARDBATCH){
+        while(guardPending&&n<M61_GUARDBATCH){
+            span *next=guardPending->next;
+            starts[n]=guardPending->start;
+            lens[n++]=guardPending->len;
+            deleteSpan(guardPending);
+            guardPending=next;
+        }
+        guardPendingCount=0;
+    }
+    pthread_mutex_unlock(&heapLock);
+    for(int i=0;i<n;++i)
+        munmap(starts[i],lens[i]);
+}
+
+//returns the backpack of the block with payload ptr of sz bytes, or NULL if it has none:
+//guarded blocks have the guard page instead, and a size beyond the capacity of the block means that the metadata was overwritten
+backpack *findBackpack(span *s, void *ptr, size_t sz, size_t capacity){
+    if(s->guarded||sz>capacity)
+        return NULL;
+    return (backpack *)((char *)ptr+sz);
+}
+
+//the redzone behind the backpack has to be intact as well
+int backpackIntact(span *s, backpack *backpack_ptr){
+    return s->guarded||(backpack_ptr&&backpack_ptr==backpack_ptr->self
+                        &&findMismatch((const unsigned char *)(backpack_ptr+1),redzoneSize,M61_REDZONEBYTE)==redzoneSize);
+}
+
+//returns the largest payload that fits into the block meta_ptr of span s
+size_t blockCapacity(span *s, metadata *meta_ptr){
+    if(s->guarded)
+        return (size_t)(s->start+s->len-pageSize-(char *)getPayload(meta_ptr));
+    if(!s->blocksz)
+        return (size_t)(s->start+s->len-(char *)getPayload(meta_ptr))-trailerSize;
+    return s->blocksz-sizeof(metadata)-trailerSize;
+}
+
+//gives a block with full metadata back once it is freed, an aligned block may come from a bigger size class than its size asks for
+void releaseBlock(span *s, metadata *meta_ptr, size_t sz){
+    if(s->guarded)
+        retireGuarded(s);
+    else
+        quarantineBlock(meta_ptr,s->blocksz?s->blocksz:sizeof(metadata)+sz+trailerSize,getPayload(meta_ptr),sz,0);
+}
+
+//poisons the payload of a freed block and holds the block back from reuse, the oldest blocks leave the quarantine once it holds more than
+//quarantineBudget bytes; without a quarantine (or for a block bigger than the whole budget) the block is freed right away
+void quarantineBlock(void *block, size_t blocksz, void *payload, size_t sz, int compact){
+    if(!quarantineBudget||sz>quarantineBudget){
+        freeBlock(block,blocksz);
+        return;
+    }
+    memset(payload,M61_POISON,sz);
+    pthread_mutex_lock(&quarantineLock);
+    if(quarantineCount==quarantineCapacity){
+        //the ring grows by copying its entries in order into a mapping twice as big
+        size_t grown=quarantineCapacity?quarantineCapacity*2:1024;
+        quarantineEntry *ring=mapInternal(grown*sizeof(quarantineEntry));
+        if(!ring){
+            pthread_mutex_unlock(&quarantineLock);
+            freeBlock(block,blocksz);
+            return;
+        }
+        for(size_t i=0;i<quarantineCount;++i)
+            ring[i]=quarantine[(quarantineHead+i)%quarantineCapacity];
+        if(quarantine)
+            munmap(quarantine,quarantineCapacity*sizeof(quarantineEntry));
+        quarantine=ring;
+        quarantineCapacity=grown;
+        quarantineHead=0;
+    }
+    quarantineEntry *entry=&quarantine[(quarantineHead+quarantineCount++)%quarantineCapacity];
+    entry->block=block;
+    entry->blocksz=blocksz;
+    entry->payload=payload;
+    entry->sz=sz;
+    entry->compact=compact;
+    quarantineBytes+=sz;
+    while(quarantineBytes>quarantineBudget){
+        quarantineEntry evicted=quarantine[quarantineHead];
+        quarantineHead=(quarantineHead+1)%quarantineCapacity;
+        --quarantineCount;
+        quarantineBytes-=evicted.sz;
+        pthread_mutex_unlock(&quarantineLock);
+        checkQuarantined(&evicted);
+        freeBlock(evicted.block,evicted.blocksz);
+        pthread_mutex_lock(&quarantineLock);
+    }
+    pthread_mutex_unlock(&quarantineLock);
+}
+
+//returns the offset of the first byte of p[0..n) that isn't pattern, or n if they all are (M61_POISON for the quarantine, M61_REDZONEBYTE
+//for redzones); compares 16 bytes at a time with SSE2 (or 8 bytes at a time without)
+size_t findMismatch(const unsigned char *p, size_t n, unsigned char pattern){
+    size_t i=0;
+#ifdef __SSE2__
+    __m128i expected=_mm_set1_epi8((char)pattern);
+    for(;i+16<=n;i+=16)
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p+i)),expected))!=0xffff)
+            break;
+#else
+    uint64_t expected=0x0101010101010101ULL*pattern;
+    for(;i+8<=n;i+=8){
+        uint64_t word;
+        memcpy(&word,p+i,8);
+        if(word!=expected)
+            break;
+    }
+#endif
+    for(;i<n;++i)
+        if(p[i]!=pattern)
+            return i;
+    return n;
+}
+
+//reports a block that was written to while it was in the quarantine, together with the site that freed it
+void checkQuarantined(quarantineEntry *entry){
+    size_t offset=findMismatch(entry->payload,entry->sz,M61_POISON);
+    if(offset==entry->sz)
+        return;
+    callSite *freedAt=siteAt(entry->compact?records[((compactHeader *)entry->block)->slot].site:((metadata *)entry->block)->freedSite);
+    fprintf(reportStream(),"MEMORY BUG: %s:%i: use after free of pointer %p, byte %zu was written after the pointer was freed here\n",freedAt->file,freedAt->line,(void *)entry->payload,offset);
+}
+
+//returns the header of the compact block of slab s that contains ptr, or NULL if there is no valid header
+compactHeader *findCompactBlock(span *s, void *ptr){
+    compactHeader *header=(compactHeader *)blockContaining(s,ptr);
+    if(!header||(header->slot^M61_TAGMAGIC)!=header->tag||header->slot>=__atomic_load_n(&nextSlot,__ATOMIC_ACQUIRE))
+        return NULL;
+    return header;
+}
+
+//m61_malloc() for small blocks in compact mode, and m61_memalign() for an alignment above 16 (0 otherwise): the payload then starts
+//alignment bytes into a block of the smallest size class whose blocks are a multiple of it, which are aligned as slabs start at a page
+void *compactMalloc(threadState *t, size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    size_t blocksz=(alignment?alignment:sizeof(compactHeader))+sz+sizeof(backpack);
+    if(alignment){
+        int index=sizeClassIndex(blocksz);
+        while(sizeClassBlockSize(index)%alignment)
+            ++index;
+        blocksz=sizeClassBlockSize(index);
+    }
+    compactHeader *header=allocateBlock(blocksz);
+    if(header==NULL){
+        allocationFailedWithSize(t,sz);
+        return NULL;
+    }
+    //a block keeps its slot for good, fresh blocks (and blocks whose header was destroyed) get a new one
+    if((header->slot^M61_TAGMAGIC)!=header->tag||header->slot>=__atomic_load_n(&nextSlot,__ATOMIC_ACQUIRE)){
+        uint32_t slot=__atomic_fetch_add(&nextSlot,1,__ATOMIC_ACQ_REL);
+        if(slot>=M61_MAXSLOTS){
+            freeBlock(header,blocksz);
+            allocationFailedWithSize(t,sz);
+            return NULL;
+        }
+        header->slot=slot;
+        header->tag=slot^M61_TAGMAGIC;
+    }
+    return compactRecordAllocation(t,header,alignment?(unsigned)__builtin_ctzll(alignment):0,sz,file,line,site,frame);
+}
+
+//does the bookkeeping of a new allocation of sz bytes in the compact block header: record, backpack, trackers and statistics
+//the payload is 2^shift bytes into the block, right behind the header for a shift of 0
+void *compactRecordAllocation(threadState *t, compactHeader *header, unsigned shift, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    if(!site)
+        site=siteIntern(file,line);
+    if(sampleAllocation(t,sz)){
+        uint32_t key=trackingKey(site,frame);
+        pthread_mutex_lock(&t->lock);
+        trackAllocByHH(t,sz,key,sampleWeight(sz));   //update HeavyHitterStats
+        pthread_mutex_unlock(&t->lock);
+    }
+    records[header->slot].birth=birthTime(t);
+    countAllocation(t,sz,site,file,line);
+    records[header->slot].site=site;
+    uint32_t szflags=M61_RECORDLIVE|shift<<M61_RECORDOFFSETSHIFT|(uint32_t)sz;
+    __atomic_store_n(&records[header->slot].szflags,szflags,__ATOMIC_RELEASE);
+    void *ptr=compactPayload(header,szflags);
+    backpack *backpack_ptr=(backpack *)((char *)ptr+sz);
+    backpack_ptr->self=backpack_ptr;
+    return ptr;
+}
+
+//m61_free() for pointers into the slabs in compact mode, the state of the allocation is read from its record
+void compactFree(span *s, void *ptr, size_t sized, const char *file, int line, uint32_t site){
+    compactHeader *header=findCompactBlock(s,ptr);
+    if(header==NULL){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: invalid free of pointer %p, not allocated\n",file,line,ptr);
+        return;
+    }
+    allocRecord *record=&records[header->slot];
+    uint32_t szflags=__atomic_load_n(&record->szflags,__ATOMIC_ACQUIRE);
+    void *payload=compactPayload(header,szflags);
+    if(payload!=ptr){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: invalid free of pointer %p, not allocated\n",file,line,ptr);
+        if(szflags&M61_RECORDLIVE&&ptr>payload&&(size_t)((char *)ptr-(char *)payload)<(szflags&M61_RECORDSIZE))
+            fprintf(reportStream(),"  %s:%i: %p is %zu bytes inside a %u byte region allocated here\n",siteAt(record->site)->file,siteAt(record->site)->line,ptr,(size_t)((char *)ptr-(char *)payload),szflags&M61_RECORDSIZE);
+        return;
+    }
+    if(szflags&M61_RECORDFREED){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: double free of pointer %p\n",file,line,ptr);
+        fprintf(reportStream(),"  %s:%i: pointer %p previously freed here\n",siteAt(record->site)->file,siteAt(record->site)->line,ptr);
+        return;
+    }
+    if(!(szflags&M61_RECORDLIVE)){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: invalid free of pointer %p, not allocated\n",file,line,ptr);
+        return;
+    }
+    size_t sz=szflags&M61_RECORDSIZE;
+    if(sized!=M61_UNSIZED&&sized!=sz)
+        reportSizeMismatch(ptr,sized,sz,file,line);
+    backpack *backpack_ptr=(backpack *)((char *)ptr+sz);
+    unsigned short int backpackIsValid=(backpack_ptr==backpack_ptr->self);
+    //the record changes from live to freed exactly once, a concurrent free of the same pointer loses this race
+    if(!__atomic_compare_exchange_n(&record->szflags,&szflags,M61_RECORDFREED|(szflags&M61_RECORDOFFSET)|(uint32_t)sz,0,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: double free of pointer %p\n",file,line,ptr);
+        return;
+    }
+    uint32_t allocatedAt=record->site;
+    record->site=site?site:siteIntern(file,line);
+    if(!backpackIsValid){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: detected wild write during free of pointer %p\n",file,line,ptr);
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: boundary write error!\n",file,line);
+    }
+    threadState *t=currentThread();
+    countFree(t,sz,record->birth,allocatedAt);
+    backpack_ptr->self=NULL;
+    quarantineBlock(header,s->blocksz,ptr,sz,1);
+}
+
+//returns the payload of the compact block header with the record szflags
+void *compactPayload(compactHeader *header, uint32_t szflags){
+    unsigned shift=(szflags&M61_RECORDOFFSET)>>M61_RECORDOFFSETSHIFT;
+    return shift?(void *)((char *)header+((size_t)1<<shift)):(void *)(header+1);
+}
+
+//reports the live compact blocks by walking all slabs
+void compactLeakReport(void){
+    uint32_t slots=__atomic_load_n(&nextSlot,__ATOMIC_ACQUIRE);
+    for(span *slab=__atomic_load_n(&slabs,__ATOMIC_ACQUIRE);slab;slab=slab->next){
+        for(char *block=slab->start;block+slab->blocksz<=slab->start+slab->len;block+=slab->blocksz){
+            compactHeader *header=(compactHeader *)block;
+            if((header->slot^M61_TAGMAGIC)!=header->tag||header->slot>=slots)
+                continue;
+            allocRecord *record=&records[header->slot];
+            uint32_t szflags=__atomic_load_n(&record->szflags,__ATOMIC_ACQUIRE);
+            if(szflags&M61_RECORDLIVE)
+                fprintf(reportStream(),"LEAK CHECK: %s:%d: allocated object %p with size %u\n",siteAt(record->site)->file,siteAt(record->site)->line,compactPayload(header,szflags),szflags&M61_RECORDSIZE);
+        }
+    }
+}
+
+//returns a uniformly distributed number in [0,1) from the thread's xorshift64* generator
+double sampleRandom(threadState *t){
+    uint64_t x=t->random;
+    x^=x>>12;
+    x^=x<<25;
+    x^=x>>27;
+    t->random=x;
+    return ((x*0x2545f4914f6cdd1dULL)>>11)*(1.0/9007199254740992.0);
+}
+
+//counts sz bytes towards the next sample and returns whether this allocation is sampled
+//the distance between samples is exponentially distributed, so every byte has the same chance 1/sampleRate of being sampled
+int sampleAllocation(threadState *t, size_t sz){
+    if(!sampleRate)
+        return 1;
+    if(t->untilSample>sz){
+        t->untilSample-=sz;
+        return 0;
+    }
+    t->untilSample=(unsigned long long)(-log(1-sampleRandom(t))*sampleRate)+1;
+    return 1;
+}
+
+//returns how many allocations of size sz a sampled allocation of this size stands for (the inverse of its sampling probability)
+double sampleWeight(size_t sz){
+    if(!sampleRate)
+        return 1;
+    return 1/-expm1(-(double)sz/sampleRate);
+}
+
+//rounds x up or down at random so that the expected value is x, that way the scaled counters stay unbiased
+unsigned long long roundRandomly(threadState *t, double x){
+    unsigned long long whole=(unsigned long long)x;
+    return whole+(sampleRandom(t)<x-(double)whole);
+}
+
+//returns the size that was requested for the allocation ptr (read from the record in compact mode)
+size_t payloadSize(void *ptr){
+    span *s=addressIsInHeap(ptr);
+    if(s&&s->arena)
+        return ((arenaHeader *)ptr-1)->sz;
+    if(compactMode&&s&&s->blocksz){
+        compactHeader *header=findCompactBlock(s,ptr);
+        return header?records[header->slot].szflags&M61_RECORDSIZE:0;
+    }
+    return getMetadata(ptr)->sz;
+}
+
+//the checking levels below full (M61_LEVEL) have their own allocation functions, so that none of them tests the level per call:
+//off only keeps the size in the metadata, counters adds the statistics and bounds adds the checks of the metadata, the backpack
+//and the redzone, the guard pages and the quarantine; bounds blocks are untracked like the unsampled blocks of sampling mode
+
+//an allocation of the off level, the size is what m61_realloc() and the free of a large block need; self is for m61_malloc_usable_size()
+void *offAllocation(metadata *meta_ptr, size_t sz){
+    if(meta_ptr==NULL)
+        return NULL;
+    meta_ptr->sz=sz;
+    meta_ptr->self=meta_ptr;
+    meta_ptr->previously_freed=0;
+    return getPayload(meta_ptr);
+}
+
+void *offMalloc(size_t sz, const char *file, int line, uint32_t site, void **frame){
+    (void) file, (void) line, (void) site, (void) frame;
+    return offAllocation(sz>maximumSizeValid()?NULL:allocateBlock(sizeof(metadata)+sz+trailerSize),sz);
+}
+
+void *offMemalign(size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    (void) file, (void) line, (void) site, (void) frame;
+    return offAllocation(sz>maximumSizeValid()?NULL:allocateAlignedBlock(alignment,sz),sz);
+}
+
+//pointers that m61 didn't hand out are ignored, nothing else is checked
+void offFree(void *ptr, size_t sized, const char *file, int line, uint32_t site){
+    (void) sized, (void) file, (void) line, (void) site;
+    span *s=ptr?addressIsInHeap(ptr):NULL;
+    if(!s||s->arena)
+        return;
+    metadata *meta_ptr=getMetadata(ptr);
+    releaseBlock(s,meta_ptr,meta_ptr->sz);
+}
+
+void *countersAllocation(threadState *t, metadata *meta_ptr, size_t sz, const char *file, int line){
+    if(meta_ptr==NULL){
+        allocationFailedWithSize(t,sz);
+        return NULL;
+    }
+    meta_ptr->sz=sz;
+    meta_ptr->self=meta_ptr;
+    meta_ptr->previously_freed=0;
+    meta_ptr->birth=birthTime(t);
+    countAllocation(t,sz,0,file,line);
+    return getPayload(meta_ptr);
+}
+
+void *countersMalloc(size_t sz, const char *file, int line, uint32_t site, void **frame){
+    (void) site, (void) frame;
+    return countersAllocation(currentThread(),sz>maximumSizeValid()?NULL:allocateBlock(sizeof(metadata)+sz+trailerSize),sz,file,line);
+}
+
+void *countersMemalign(size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    (void) site, (void) frame;
+    return countersAllocation(currentThread(),sz>maximumSizeValid()?NULL:allocateAlignedBlock(alignment,sz),sz,file,line);
+}
+
+void countersFree(void *ptr, size_t sized, const char *file, int line, uint32_t site){
+    (void) sized, (void) file, (void) line, (void) site;
+    span *s=ptr?addressIsInHeap(ptr):NULL;
+    if(!s||s->arena)
+        return;
+    metadata *meta_ptr=getMetadata(ptr);
+    size_t sz=meta_ptr->sz;
+    countFree(currentThread(),sz,meta_ptr->birth,0);
+    releaseBlock(s,meta_ptr,sz);
+}
+
+//the bounds level frees with m61_free()'s own checks, which know untracked blocks
+void *boundsAllocation(threadState *t, metadata *meta_ptr, size_t sz, const char *file, int line, uint32_t site){
+    if(meta_ptr==NULL){
+        allocationFailedWithSize(t,sz);
+        return NULL;
+    }
+    initBlock(t,meta_ptr,sz,file,line,site);
+    return untrackedAllocation(t,meta_ptr,sz,file,line);
+}
+
+void *boundsMalloc(size_t sz, const char *file, int line, uint32_t site, void **frame){
+    (void) frame;
+    metadata *meta_ptr=NULL;
+    if(sz<=maximumSizeValid())
+        meta_ptr=isGuardedSize(sz)?allocateGuarded(sz,M61_GUARDALIGN):allocateBlock(sizeof(metadata)+sz+trailerSize);
+    return boundsAllocation(currentThread(),meta_ptr,sz,file,line,site);
+}
+
+void *boundsMemalign(size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    (void) frame;
+    return boundsAllocation(currentThread(),sz>maximumSizeValid()?NULL:allocateAlignedBlock(alignment,sz),sz,file,line,site);
+}
+
+//below the full level m61_realloc() always moves the block
+void *noReallocInPlace(void *ptr, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    (void) ptr, (void) sz, (void) file, (void) line, (void) site, (void) frame;
+    return NULL;
+}
+
+//the first call initializes m61, which picks the level, and goes on with the function of that level
+void *startMalloc(size_t sz, const char *file, int line, uint32_t site, void **frame){
+    pthread_once(&initOnce,m61Init);
+    return __atomic_load_n(&checks,__ATOMIC_ACQUIRE)->malloc(sz,file,line,site,frame);
+}
+
+void startFree(void *ptr, size_t sz, const char *file, int line, uint32_t site){
+    pthread_once(&initOnce,m61Init);
+    __atomic_load_n(&checks,__ATOMIC_ACQUIRE)->free(ptr,sz,file,line,site);
+}
+
+void *startMemalign(size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    pthread_once(&initOnce,m61Init);
+    return __atomic_load_n(&checks,__ATOMIC_ACQUIRE)->memalign(alignment,sz,file,line,site,frame);
+}
+
+void *startReallocInPlace(void *ptr, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    pthread_once(&initOnce,m61Init);
+    return __atomic_load_n(&checks,__ATOMIC_ACQUIRE)->reallocInPlace(ptr,sz,file,line,site,frame);
+}
+
+//The m61_* functions take the call site as file and line, their *_site versions as the id that M61_SITE() caches for the macro
+//expansion; both share these bodies. A site of 0 is interned from file and line when it is needed. frame is the frame of the m61
+//function that was called, the backtraces of stack mode start at its caller
+void *mallocCall(size_t sz, const char *file, int line, uint32_t site, void **frame){
+    void *ptr=__atomic_load_n(&checks,__ATOMIC_ACQUIRE)->malloc(sz,file,line,site,frame);
+    if(__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+        traceEvent(M61_TRACE_MALLOC,file,line,sz,ptr,NULL,site);
+    return ptr;
+}
+
+void *m61_malloc(size_t sz, const char *file, int line) {
+    return mallocCall(sz,file,line,0,__builtin_frame_address(0));
+}
+
+void *m61_malloc_site(size_t sz, uint32_t site) {
+    return mallocCall(sz,siteAt(site)->file,siteAt(site)->line,site,__builtin_frame_address(0));
+}
+
+//m61_malloc() for the m61 function whose frame is frame, the backtraces of stack mode start at the caller of that function
+void *mallocAt(size_t sz, const char *file, int line, uint32_t site, void **frame){
+    (void) file, (void) line;   //avoid uninitialized variable warnings
+    if(!__atomic_load_n(&m61Initialized,__ATOMIC_ACQUIRE))
+        pthread_once(&initOnce,m61Init);
+    threadState *t=currentThread();
+    if(__atomic_load_n(&t->remoteFrees,__ATOMIC_RELAXED))
+        drainRemoteFrees(t);
+    if(sz>maximumSizeValid()){
+        allocationFailedWithSize(t,sz);
+	    return NULL;
+    }
+    if(compactMode&&sizeof(compactHeader)+sz+sizeof(backpack)<=M61_MAXCLASS&&!isGuardedSize(sz))
+        return compactMalloc(t,0,sz,file,line,site,frame);
+	    
+    metadata *meta_ptr=isGuardedSize(sz)?allocateGuarded(sz,M61_GUARDALIGN):allocateBlock(sizeof(metadata)+sz+trailerSize);
+	if(meta_ptr==NULL){
+        allocationFailedWithSize(t,sz);
+		return NULL;
+	}
+	return recordAllocation(t,meta_ptr,sz,file,line,site,frame);
+}
+
+//writes the metadata, the backpack and the redzone of a new allocation of sz bytes in the block meta_ptr
+void initBlock(threadState *t, metadata *meta_ptr, size_t sz, const char *file, int line, uint32_t site){
+	//save size and address of metadata struct to metadata
+    meta_ptr->sz=sz;
+    meta_ptr->self=meta_ptr;
+    meta_ptr->previously_freed=0;
+    meta_ptr->reported=0;
+    meta_ptr->owner=t;
+    meta_ptr->site=site?site:siteIntern(file,line);
+    meta_ptr->birth=birthTime(t);
+    //save address of metadata struct to backpack, guarded blocks end at their guard page instead
+    if(!isGuardedSize(sz)){
+        backpack *backpack_ptr=(backpack *)((char *)meta_ptr+sz+sizeof(metadata));
+        backpack_ptr->self=backpack_ptr;
+        memset(backpack_ptr+1,M61_REDZONEBYTE,redzoneSize);
+    }
+}
+
+//an allocation that isn't tracked has no owner and isn't linked into a list, m61_free() checks it by its metadata and backpack alone
+void *untrackedAllocation(threadState *t, metadata *meta_ptr, size_t sz, const char *file, int line){
+    meta_ptr->owner=NULL;
+    meta_ptr->key=0;
+    meta_ptr->prv=NULL;
+    meta_ptr->next=NULL;
+    countAllocation(t,sz,0,file,line);
+    return getPayload(meta_ptr);
+}
+
+void *recordAllocation(threadState *t, metadata *meta_ptr, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    initBlock(t,meta_ptr,sz,file,line,site);
+    //an allocation that isn't sampled isn't tracked
+    //the large blocks of compact mode are always linked, since the leak report of compact mode is exact
+    double weight=1;
+    if(!compactMode&&!sampleAllocation(t,sz))
+        return untrackedAllocation(t,meta_ptr,sz,file,line);
+    uint32_t key=trackingKey(meta_ptr->site,frame);
+    meta_ptr->key=key;
+    pthread_mutex_lock(&t->lock);
+    if(!compactMode)
+        weight=sampleWeight(sz);
+    trackAllocByHH(t,sz,key,weight);   //update HeavyHitterStats
+    //update links in the doubly linked list segment of this thread
+    meta_ptr->prv=t->lastAlloc;
+    meta_ptr->next=NULL;
+    if(t->lastAlloc)
+        t->lastAlloc->next=meta_ptr;
+    t->lastAlloc=meta_ptr;
+    pthread_mutex_unlock(&t->lock);
+     
+    countAllocation(t,sz,meta_ptr->site,file,line);
+	return getPayload(meta_ptr); 
+}
+
+void m61_free(void *ptr, const char *file, int line) {
+    if(__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+        traceEvent(M61_TRACE_FREE,file,line,0,ptr,NULL,0);
+    __atomic_load_n(&checks,__ATOMIC_ACQUIRE)->free(ptr,M61_UNSIZED,file,line,0);
+}
+
+void m61_free_site(void *ptr, uint32_t site) {
+    callSite *at=siteAt(site);
+    if(__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+        traceEvent(M61_TRACE_FREE,at->file,at->line,0,ptr,NULL,site);
+    __atomic_load_n(&checks,__ATOMIC_ACQUIRE)->free(ptr,M61_UNSIZED,at->file,at->line,site);
+}
+
+//m61_free() without the trace event, for the frees that are part of another call
+void freeAt(void *ptr, size_t sized, const char *file, int line, uint32_t site){
+    (void) file, (void) line;    //avoid uninitialized variable warnings
+    if(ptr==NULL){
+        return;   
+    }
+    if(!__atomic_load_n(&m61Initialized,__ATOMIC_ACQUIRE))
+        pthread_once(&initOnce,m61Init);
+    span *s=addressIsInHeap(ptr);
+    if(!s){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: invalid free of pointer %p, not in heap\n",file,line,ptr);
+        return;
+    }
+    if(s->arena){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: invalid free of pointer %p, allocated from an arena\n",file,line,ptr);
+        return;
+    }
+    //in compact mode all blocks in the slabs are compact, only large blocks carry the full metadata
+    if(compactMode&&s->blocksz){
+        compactFree(s,ptr,sized,file,line,site);
+        return;
+    }
+    //the page map tells us which block ptr points into, if ptr isn't the payload of that block it wasn't handed out by m61_malloc()
+    metadata *meta_ptr=(metadata *)blockContaining(s,ptr);
+    if(meta_ptr==NULL||(char *)ptr<(char *)getPayload(meta_ptr)){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: invalid free of pointer %p, not allocated\n",file,line,ptr);
+        return;
+    }
+    size_t capacity=blockCapacity(s,meta_ptr);  //largest payload that fits into the block
+    if(ptr!=getPayload(meta_ptr)){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: invalid free of pointer %p, not allocated\n",file,line,ptr);
+        size_t offset=(char *)ptr-(char *)getPayload(meta_ptr);
+        if(meta_ptr->self==meta_ptr&&meta_ptr->sz<=capacity&&offset<meta_ptr->sz)
+            fprintf(reportStream(),"  %s:%i: %p is %zu bytes inside a %zu byte region allocated here\n",siteAt(meta_ptr->site)->file,siteAt(meta_ptr->site)->line,ptr,offset,meta_ptr->sz);
+        return;
+    }
+    if(sized!=M61_UNSIZED&&sized!=meta_ptr->sz&&meta_ptr->self==meta_ptr&&!meta_ptr->previously_freed&&meta_ptr->sz<=capacity)
+        reportSizeMismatch(ptr,sized,meta_ptr->sz,file,line);
+    //the block is linked into the list segment of the thread that allocated it, everything below happens under that segment's lock
+    //an owner that isn't a shard means that the metadata was overwritten
+    threadState *owner=meta_ptr->owner;
+    if(untrackedBlocks&&!owner){
+        unlockedFree(s,meta_ptr,capacity,ptr,NULL,file,line,site);
+        return;
+    }
+    if(meta_ptr->self!=meta_ptr&&!isThreadState(owner)){
+        if(backpackIntact(s,findBackpack(s,ptr,meta_ptr->sz,capacity))){
+            fprintf(reportStream(),"MEMORY BUG: %s:%i: detected wild write during free of pointer %p\n",file,line,ptr);
+            fprintf(reportStream(),"MEMORY BUG: %s:%i: boundary write error!\n",file,line);
+        }
+        else
+            fprintf(reportStream(),"MEMORY BUG: %s:%i: invalid free of pointer %p, not allocated\n",file,line,ptr);
+        return;
+    }
+    //a block of another thread that is still running goes to the remote free queue of its owner, so that frees don't contend for the owner's lock
+    threadState *t=currentThread();
+    if(owner!=t&&!__atomic_load_n(&owner->retired,__ATOMIC_ACQUIRE)){
+        unlockedFree(s,meta_ptr,capacity,ptr,owner,file,line,site);
+        return;
+    }
+    if(__atomic_load_n(&t->remoteFrees,__ATOMIC_RELAXED))
+        drainRemoteFrees(t);
+    pthread_mutex_lock(&owner->lock);
+    if(meta_ptr->previously_freed){
+        const char *freedFile=siteAt(meta_ptr->freedSite)->file;
+        int freedLine=siteAt(meta_ptr->freedSite)->line;
+        pthread_mutex_unlock(&owner->lock);
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: double free of pointer %p\n",file,line,ptr);
+        fprintf(reportStream(),"  %s:%i: pointer %p previously freed here\n",freedFile,freedLine,ptr);
+        return;
+    }
+    unsigned short int metadataIsValid=(meta_ptr==meta_ptr->self);
+    
+    //a size that doesn't fit into the block means that the metadata was overwritten, the backpack can't be found then
+    backpack *backpack_ptr=findBackpack(s,ptr,meta_ptr->sz,capacity);    //construct backpack pointer
+    unsigned short int backpackIsValid=backpackIntact(s,backpack_ptr);
+
+    //The neighbours in the doubly linked list have to point back to this block, otherwise the block is not (or no longer) allocated
+    //This is checked before anything is modified so that the heap stays consistent
+    metadata *prv=meta_ptr->prv;
+    metadata *next=meta_ptr->next;
+    //If neither the metadata nor the backpack is intact, we assume that the pointer was not handed out by m61_malloc() 
+    if((!metadataIsValid&&!backpackIsValid)||(prv!=NULL&&prv->next!=meta_ptr)||(next!=NULL&&next->prv!=meta_ptr)||(next==NULL&&owner->lastAlloc!=meta_ptr)){
+        pthread_mutex_unlock(&owner->lock);
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: invalid free of pointer %p, not allocated\n",file,line,ptr);
+        return;
+    }
+
+    //a remote free of the same pointer doesn't take the lock, one of the two loses this race
+    if(__atomic_exchange_n(&meta_ptr->previously_freed,1,__ATOMIC_ACQ_REL)){
+        pthread_mutex_unlock(&owner->lock);
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: double free of pointer %p\n",file,line,ptr);
+        return;
+    }
+    size_t sz=meta_ptr->sz;
+    //make metadata and backpack invalid 
+    meta_ptr->self=NULL;
+    if(backpack_ptr)
+        backpack_ptr->self=NULL;
+    
+    meta_ptr->freedSite=site?site:siteIntern(file,line);
+
+    //Update of the doubly linked list 
+    if(owner->sweepCursor==meta_ptr)
+        owner->sweepCursor=prv;
+    if(prv!=NULL)
+        prv->next=next;
+    if(next!=NULL)
+        next->prv=prv;
+    else
+        owner->lastAlloc=prv;
+    pthread_mutex_unlock(&owner->lock);
+
+    //this is basically an XOR since 1||1 was caught above
+    //If one of metadata or backpack is not intact, we assume that a boundary write occured
+    if(!metadataIsValid||!backpackIsValid){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: detected wild write during free of pointer %p\n",file,line,ptr);
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: boundary write error!\n",file,line);
+    }
+
+    countFree(t,sz,meta_ptr->birth,keySiteId(meta_ptr->key));
+    releaseBlock(s,meta_ptr,sz);
+}
+
+//m61_free() without the lock of the owner, the checks rely on the metadata and the backpack alone: for blocks that weren't sampled,
+//which aren't in any list, and for blocks of other threads, which go to the remote free queue of their owner (the free is counted right away)
+void unlockedFree(span *s, metadata *meta_ptr, size_t capacity, void *ptr, threadState *owner, const char *file, int line, uint32_t site){
+    if(__atomic_load_n(&meta_ptr->previously_freed,__ATOMIC_ACQUIRE)){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: double free of pointer %p\n",file,line,ptr);
+        fprintf(reportStream(),"  %s:%i: pointer %p previously freed here\n",siteAt(meta_ptr->freedSite)->file,siteAt(meta_ptr->freedSite)->line,ptr);
+        return;
+    }
+    unsigned short int metadataIsValid=(meta_ptr==meta_ptr->self);
+    backpack *backpack_ptr=findBackpack(s,ptr,meta_ptr->sz,capacity);
+    unsigned short int backpackIsValid=backpackIntact(s,backpack_ptr);
+    if(!metadataIsValid&&!backpackIsValid){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: invalid free of pointer %p, not allocated\n",file,line,ptr);
+        return;
+    }
+    //only one of two concurrent frees of the same pointer gets to free the block
+    if(__atomic_exchange_n(&meta_ptr->previously_freed,1,__ATOMIC_ACQ_REL)){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: double free of pointer %p\n",file,line,ptr);
+        return;
+    }
+    size_t sz=meta_ptr->sz;
+    meta_ptr->self=NULL;
+    if(backpack_ptr)
+        backpack_ptr->self=NULL;
+    meta_ptr->freedSite=site?site:siteIntern(file,line);
+    if(!metadataIsValid||!backpackIsValid){
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: detected wild write during free of pointer %p\n",file,line,ptr);
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: boundary write error!\n",file,line);
+    }
+    threadState *t=currentThread();
+    countFree(t,sz,meta_ptr->birth,owner?keySiteId(meta_ptr->key):0);
+    if(!owner){
+        releaseBlock(s,meta_ptr,sz);
+        return;
+    }
+    //the block stays linked into the owner's segment until the owner (or a report) drains the queue, self links the queue
+    meta_ptr->self=__atomic_load_n(&owner->remoteFrees,__ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&owner->remoteFrees,&meta_ptr->self,meta_ptr,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED))
+        ;
+}
+
+//unlinks the blocks that other threads freed from the segment of t and releases them
+void drainRemoteFrees(threadState *t){
+    pthread_mutex_lock(&t->lock);
+    metadata *queue=__atomic_exchange_n(&t->remoteFrees,NULL,__ATOMIC_ACQUIRE);
+    for(metadata *meta_ptr=queue;meta_ptr;meta_ptr=meta_ptr->self){
+        if(t->sweepCursor==meta_ptr)
+            t->sweepCursor=meta_ptr->prv;
+        if(meta_ptr->prv!=NULL)
+            meta_ptr->prv->next=meta_ptr->next;
+        if(meta_ptr->next!=NULL)
+            meta_ptr->next->prv=meta_ptr->prv;
+        else
+            t->lastAlloc=meta_ptr->prv;
+    }
+    pthread_mutex_unlock(&t->lock);
+    //the quarantine lock nests outside of the shard locks, so the blocks are released after the unlock
+    while(queue){
+        metadata *next=queue->self;
+        queue->self=NULL;
+        releaseBlock(addressIsInHeap(queue),queue,queue->sz);
+        queue=next;
+    }
+}
+
+//checks the metadata, the backpack and the redzone of the live block meta_ptr of t for the sweeper, called with the lock of t held
+//returns 0 if the metadata was overwritten, the links to the older blocks can't be trusted then
+int sweepBlock(threadState *t, metadata *meta_ptr){
+    //a block that another thread freed stays linked until t drains its remote free queue, self links the queue
+    if(__atomic_load_n(&meta_ptr->previously_freed,__ATOMIC_ACQUIRE))
+        return 1;
+    uint32_t site=meta_ptr->site<=__atomic_load_n(&nsites,__ATOMIC_ACQUIRE)?meta_ptr->site:0;
+    if(meta_ptr->self!=meta_ptr){
+        if(t->sweepBroken!=meta_ptr){
+            t->sweepBroken=meta_ptr;
+            fprintf(reportStream(),"MEMORY BUG: %s:%i: detected wild write into the metadata of allocated object %p\n",siteAt(site)->file,siteAt(site)->line,getPayload(meta_ptr));
+        }
+        return 0;
+    }
+    span *s=addressIsInHeap(meta_ptr);
+    if(meta_ptr->reported||!s||backpackIntact(s,findBackpack(s,getPayload(meta_ptr),meta_ptr->sz,blockCapacity(s,meta_ptr))))
+        return 1;
+    //a remote free invalidates the backpack after it marks the block as freed
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&meta_ptr->previously_freed,__ATOMIC_ACQUIRE))
+        return 1;
+    meta_ptr->reported=1;
+    fprintf(reportStream(),"MEMORY BUG: %s:%i: detected wild write past the end of allocated object %p with size %zu\n",siteAt(site)->file,siteAt(site)->line,getPayload(meta_ptr),meta_ptr->sz);
+    return 1;
+}
+
+//checks the next M61_SWEEPBATCH blocks of the allocation list segment of t, from the newest block to the oldest one and then over again
+void sweepShard(threadState *t){
+    pthread_mutex_lock(&t->lock);
+    metadata *meta_ptr=t->sweepCursor?t->sweepCursor:t->lastAlloc;
+    for(int n=0;meta_ptr&&n<M61_SWEEPBATCH;++n)
+        meta_ptr=sweepBlock(t,meta_ptr)?meta_ptr->prv:NULL;
+    t->sweepCursor=meta_ptr;
+    pthread_mutex_unlock(&t->lock);
+}
+
+//checks the live blocks in the background, a batch of every thread per round; after a round the thread sleeps long enough for the CPU
+//time of the round to stay within sweepBudget percent
+void *sweepThread(void *arg){
+    (void) arg;
+    for(;;){
+        struct timespec start, end;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID,&start);
+        for(threadState *t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next)
+            sweepShard(t);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID,&end);
+        long long used=(end.tv_sec-start.tv_sec)*1000000000LL+end.tv_nsec-start.tv_nsec;
+        long long pause=used*(100-sweepBudget)/sweepBudget;
+        if(pause<M61_SWEEPPAUSE)
+            pause=M61_SWEEPPAUSE;
+        struct timespec interval={pause/1000000000,pause%1000000000};
+        nanosleep(&interval,NULL);
+    }
+    return NULL;
+}
+
+//checks every live block that is linked into an allocation list right away, like a round of the sweeper over all of the blocks
+void m61_sweep(void){
+    for(threadState *t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next){
+        pthread_mutex_lock(&t->lock);
+        for(metadata *meta_ptr=t->lastAlloc;meta_ptr&&sweepBlock(t,meta_ptr);meta_ptr=meta_ptr->prv)
+            ;
+        pthread_mutex_unlock(&t->lock);
+    }
+}
+
+//takes a block out of the allocation list segment of its owner
+void unlinkBlock(threadState *owner, metadata *meta_ptr){
+    pthread_mutex_lock(&owner->lock);
+    if(owner->sweepCursor==meta_ptr)
+        owner->sweepCursor=meta_ptr->prv;
+    if(meta_ptr->prv!=NULL)
+        meta_ptr->prv->next=meta_ptr->next;
+    if(meta_ptr->next!=NULL)
+        meta_ptr->next->prv=meta_ptr->prv;
+    else
+        owner->lastAlloc=meta_ptr->prv;
+    pthread_mutex_unlock(&owner->lock);
+}
+
+//moves the large block of span s to a mapping of len bytes with mremap(), which doesn't copy the pages
+//returns the new address of the block, or NULL if it couldn't be remapped (the block is left where it was then)
+metadata *remapLarge(span *s, size_t len){
+    char *start=s->start;
+    size_t oldLen=s->len;
+    pthread_mutex_lock(&heapLock);
+    deleteSpan(s);
+    char *moved=mremap(start,oldLen,len,MREMAP_MAYMOVE);
+    if(moved==MAP_FAILED)
+        moved=NULL;
+    //the descriptor that deleteSpan() recycled is reused, only a new page map leaf can fail; the block moves back in that case
+    else if(!newSpan(moved,len,0)){
+        if(mremap(moved,len,oldLen,MREMAP_MAYMOVE|MREMAP_FIXED,start)==MAP_FAILED)
+            abort();
+        moved=NULL;
+    }
+    if(!moved&&!newSpan(start,oldLen,0))
+        abort();
+    pthread_mutex_unlock(&heapLock);
+    return (metadata *)moved;
+}
+
+//resizes the live block ptr without copying: a small block stays in place if the new size falls into the same size class,
+//a large block stays in place while it fits its mapping, and is moved with mremap() otherwise (growing by at least half,
+//so that a block grown step by step is remapped only a logarithmic number of times) or once it uses less than a quarter of it
+//the block is then handled like a new allocation of sz bytes at file:line; returns NULL if the block can't be resized that way
+//(or isn't a live block, m61_realloc() then takes the slow path which reports the bug)
+void *reallocInPlace(void *ptr, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    span *s=addressIsInHeap(ptr);
+    if(!s||sz>maximumSizeValid())
+        return NULL;
+    if(compactMode&&s->blocksz)
+        return compactRealloc(s,ptr,sz,file,line,site,frame);
+    //guarded blocks always get a new mapping, so that the payload ends at the guard page again, as do large aligned blocks
+    if(s->guarded||isGuardedSize(sz)||s->block!=s->start)
+        return NULL;
+    metadata *meta_ptr=(metadata *)blockContaining(s,ptr);
+    if(meta_ptr==NULL||ptr!=getPayload(meta_ptr)||meta_ptr->self!=meta_ptr||meta_ptr->previously_freed)
+        return NULL;
+    size_t capacity=(s->blocksz?s->blocksz:s->len)-sizeof(metadata)-trailerSize;
+    size_t oldSz=meta_ptr->sz;
+    backpack *backpack_ptr=(backpack *)((char *)ptr+oldSz);
+    if(oldSz>capacity||!backpackIntact(s,backpack_ptr))
+        return NULL;
+    threadState *owner=meta_ptr->owner;
+    if(owner&&!isThreadState(owner))
+        return NULL;
+    size_t blocksz=sizeof(metadata)+sz+trailerSize;
+    size_t len=0;
+    if(s->blocksz&&(blocksz>M61_MAXCLASS||sizeClassIndex(blocksz)!=sizeClassIndex(s->blocksz)))
+        return NULL;
+    if(!s->blocksz){
+        if(blocksz<=M61_MAXCLASS)
+            return NULL;
+        len=largeMappingSize(blocksz);
+        if(len>s->len&&len<s->len+s->len/2)
+            len=largeMappingSize(s->len+s->len/2);
+        else if(len<=s->len&&len>s->len/4)
+            len=0;
+    }
+
+    //the block leaves the list segment of its owner, it is linked in again as a new allocation of this thread
+    //(the neighbours would point to the old address of a moved block)
+    if(owner)
+        unlinkBlock(owner,meta_ptr);
+    backpack_ptr->self=NULL;
+    if(len){
+        metadata *moved=remapLarge(s,len);
+        if(!moved){
+            backpack_ptr->self=backpack_ptr;
+            if(owner){
+                pthread_mutex_lock(&owner->lock);
+                meta_ptr->prv=owner->lastAlloc;
+                meta_ptr->next=NULL;
+                if(owner->lastAlloc)
+                    owner->lastAlloc->next=meta_ptr;
+                owner->lastAlloc=meta_ptr;
+                pthread_mutex_unlock(&owner->lock);
+            }
+            return NULL;
+        }
+        meta_ptr=moved;
+    }
+    threadState *t=currentThread();
+    countFree(t,oldSz,meta_ptr->birth,keySiteId(meta_ptr->key));
+    return recordAllocation(t,meta_ptr,sz,file,line,site,frame);
+}
+
+//reallocInPlace() for compact blocks, the size in the record changes from the old size to the new one exactly once
+void *compactRealloc(span *s, void *ptr, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    compactHeader *header=findCompactBlock(s,ptr);
+    size_t blocksz=sizeof(compactHeader)+sz+sizeof(backpack);
+    if(header==NULL||(void *)(header+1)!=ptr||blocksz>M61_MAXCLASS||sizeClassIndex(blocksz)!=sizeClassIndex(s->blocksz)||isGuardedSize(sz))
+        return NULL;
+    allocRecord *record=&records[header->slot];
+    uint32_t szflags=__atomic_load_n(&record->szflags,__ATOMIC_ACQUIRE);
+    if(!(szflags&M61_RECORDLIVE))
+        return NULL;
+    size_t oldSz=szflags&M61_RECORDSIZE;
+    backpack *backpack_ptr=(backpack *)((char *)ptr+oldSz);
+    if(backpack_ptr!=backpack_ptr->self||!__atomic_compare_exchange_n(&record->szflags,&szflags,M61_RECORDLIVE|(uint32_t)sz,0,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE))
+        return NULL;
+    backpack_ptr->self=NULL;
+    threadState *t=currentThread();
+    countFree(t,oldSz,record->birth,record->site);
+    return compactRecordAllocation(t,header,0,sz,file,line,site,frame);
+}
+
+void *reallocCall(void *ptr, size_t sz, const char *file, int line, uint32_t site, void **frame) {
+    (void) file, (void) line;	// avoid uninitialized variable warnings
+    void *new_ptr = NULL;
+    span *s = ptr ? addressIsInHeap(ptr) : NULL;
+    if (s && s->arena) {
+        fprintf(reportStream(),"MEMORY BUG: %s:%i: invalid realloc of pointer %p, allocated from an arena\n",file,line,ptr);
+        return NULL;
+    }
+    if (ptr != NULL && sz != 0 && (new_ptr = __atomic_load_n(&checks,__ATOMIC_ACQUIRE)->reallocInPlace(ptr,sz,file,line,site,frame))) {
+        if (__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+            traceEvent(M61_TRACE_REALLOC,file,line,sz,ptr,new_ptr,site);
+        return new_ptr;
+    }
+    if (sz != 0 && ptr != NULL) {
+        threadState *t = currentThread();
+        t->growing = 1;
+        new_ptr = __atomic_load_n(&checks,__ATOMIC_ACQUIRE)->malloc(sz,file,line,site,frame);
+        t->growing = 0;
+    } else if (sz != 0)
+        new_ptr = __atomic_load_n(&checks,__ATOMIC_ACQUIRE)->malloc(sz,file,line,site,frame);
+    if (ptr != NULL && new_ptr != NULL) {
+            size_t old_sz = payloadSize(ptr);
+            if (old_sz < sz)
+             memcpy(new_ptr, ptr, old_sz);
+        else
+             memcpy(new_ptr, ptr, sz);
+        addCounter(&currentThread()->copied_size,(unsigned long long)(old_sz<sz?old_sz:sz));
+    }
+    if (__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+        traceEvent(M61_TRACE_REALLOC,file,line,sz,ptr,new_ptr,site);
+    __atomic_load_n(&checks,__ATOMIC_ACQUIRE)->free(ptr,M61_UNSIZED,file,line,site);
+    return new_ptr;
+}
+
+void *m61_realloc(void *ptr, size_t sz, const char *file, int line) {
+    return reallocCall(ptr,sz,file,line,0,__builtin_frame_address(0));
+}
+
+void *m61_realloc_site(void *ptr, size_t sz, uint32_t site) {
+    return reallocCall(ptr,sz,siteAt(site)->file,siteAt(site)->line,site,__builtin_frame_address(0));
+}
+
+void *callocCall(size_t nmemb, size_t sz, const char *file, int line, uint32_t site, void **frame) {
+    (void) file, (void) line;	// avoid uninitialized variable warnings
+    if (nmemb!=0&&sz>maximumSizeValid()/nmemb){
+        if(!__atomic_load_n(&m61Initialized,__ATOMIC_ACQUIRE))
+            pthread_once(&initOnce,m61Init);
+        allocationFailedWithSize(currentThread(),sz);
+        if (__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+            traceEvent(M61_TRACE_CALLOC,file,line,sz,NULL,NULL,site);
+        return NULL;
+    }
+    void *ptr = __atomic_load_n(&checks,__ATOMIC_ACQUIRE)->malloc(sz * nmemb, file, line, site, frame);
+    if (__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+        traceEvent(M61_TRACE_CALLOC,file,line,sz * nmemb,ptr,NULL,site);
+    //guarded blocks are fresh mappings, which are zeroed already
+    if (ptr != NULL && !isGuardedSize(sz * nmemb))
+	memset(ptr, 0, sz * nmemb);     // clear memory to 0
+    return ptr;
+}
+
+void *m61_calloc(size_t nmemb, size_t sz, const char *file, int line) {
+    return callocCall(nmemb,sz,file,line,0,__builtin_frame_address(0));
+}
+
+void *m61_calloc_site(size_t nmemb, size_t sz, uint32_t site) {
+    return callocCall(nmemb,sz,siteAt(site)->file,siteAt(site)->line,site,__builtin_frame_address(0));
+}
+
+//maps a large block whose payload is aligned to alignment, the metadata sits right in front of the payload
+metadata *allocateAligned(size_t sz, size_t alignment){
+    if(sz>(size_t)-1-sizeof(metadata)-trailerSize-alignment-pageSize)
+        return NULL;
+    size_t len=largeMappingSize(sizeof(metadata)+sz+trailerSize+alignment-1);
+    char *start=mapMemory(len);
+    if(!start)
+        return NULL;
+    metadata *meta_ptr=(metadata *)(((uintptr_t)start+sizeof(metadata)+alignment-1)&~(uintptr_t)(alignment-1))-1;
+    pthread_mutex_lock(&heapLock);
+    span *s=newSpan(start,len,0);
+    if(s)
+        s->block=(char *)meta_ptr;
+    pthread_mutex_unlock(&heapLock);
+    if(!s){
+        munmap(start,len);
+        return NULL;
+    }
+    return meta_ptr;
+}
+
+//returns a block with full metadata whose payload of sz bytes is aligned to alignment (a power of two)
+metadata *allocateAlignedBlock(size_t alignment, size_t sz){
+    size_t blocksz=sizeof(metadata)+sz+trailerSize;
+    if(isGuardedSize(sz))
+        return allocateGuarded(sz,alignment);
+    if(alignment<=sizeof(metadata)&&(blocksz>M61_MAXCLASS||!compactMode)){
+        int index=blocksz>M61_MAXCLASS?M61_NCLASSES:sizeClassIndex(blocksz);
+        while(index<M61_NCLASSES&&sizeClassBlockSize(index)%alignment)
+            ++index;
+        return allocateBlock(index<M61_NCLASSES?sizeClassBlockSize(index):blocksz);
+    }
+    return allocateAligned(sz,alignment);
+}
+
+//m61_malloc() with a payload aligned to alignment (a power of two), payloads are 16 byte aligned anyway
+//the metadata is as big as the largest alignment that a slab can give: small blocks come from the smallest size class whose blocks are
+//a multiple of the alignment (slabs start at a page), everything else gets a mapping of its own; compact blocks put the payload further in
+void *memalignAt(size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    if(alignment<=16)
+        return mallocAt(sz,file,line,site,frame);
+    if(!__atomic_load_n(&m61Initialized,__ATOMIC_ACQUIRE))
+        pthread_once(&initOnce,m61Init);
+    threadState *t=currentThread();
+    if(__atomic_load_n(&t->remoteFrees,__ATOMIC_RELAXED))
+        drainRemoteFrees(t);
+    if(sz>maximumSizeValid()){
+        allocationFailedWithSize(t,sz);
+        return NULL;
+    }
+    if(compactMode&&alignment+sz+sizeof(backpack)<=M61_MAXCLASS&&!isGuardedSize(sz))
+        return compactMalloc(t,alignment,sz,file,line,site,frame);
+    metadata *meta_ptr=allocateAlignedBlock(alignment,sz);
+    if(meta_ptr==NULL){
+        allocationFailedWithSize(t,sz);
+        return NULL;
+    }
+    return recordAllocation(t,meta_ptr,sz,file,line,site,frame);
+}
+
+//memalign() and aligned_alloc(), returns NULL (without counting a failure) if alignment isn't a power of two
+void *memalignCall(size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    void *ptr=alignment&&!(alignment&(alignment-1))?__atomic_load_n(&checks,__ATOMIC_ACQUIRE)->memalign(alignment,sz,file,line,site,frame):NULL;
+    if(__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+        traceEvent(M61_TRACE_MALLOC,file,line,sz,ptr,NULL,site);
+    return ptr;
+}
+
+int posixMemalignCall(void **memptr, size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame){
+    if(!alignment||alignment&(alignment-1)||alignment%sizeof(void *))
+        return EINVAL;
+    void *ptr=__atomic_load_n(&checks,__ATOMIC_ACQUIRE)->memalign(alignment,sz,file,line,site,frame);
+    if(__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+        traceEvent(M61_TRACE_MALLOC,file,line,sz,ptr,NULL,site);
+    if(!ptr)
+        return ENOMEM;
+    *memptr=ptr;
+    return 0;
+}
+
+void *m61_memalign(size_t alignment, size_t sz, const char *file, int line) {
+    return memalignCall(alignment,sz,file,line,0,__builtin_frame_address(0));
+}
+
+void *m61_memalign_site(size_t alignment, size_t sz, uint32_t site) {
+    return memalignCall(alignment,sz,siteAt(site)->file,siteAt(site)->line,site,__builtin_frame_address(0));
+}
+
+int m61_posix_memalign(void **memptr, size_t alignment, size_t sz, const char *file, int line) {
+    return posixMemalignCall(memptr,alignment,sz,file,line,0,__builtin_frame_address(0));
+}
+
+int m61_posix_memalign_site(void **memptr, size_t alignment, size_t sz, uint32_t site) {
+    return posixMemalignCall(memptr,alignment,sz,siteAt(site)->file,siteAt(site)->line,site,__builtin_frame_address(0));
+}
+
+void *m61_aligned_alloc(size_t alignment, size_t sz, const char *file, int line) {
+    return memalignCall(alignment,sz,file,line,0,__builtin_frame_address(0));
+}
+
+void *m61_aligned_alloc_site(size_t alignment, size_t sz, uint32_t site) {
+    return memalignCall(alignment,sz,siteAt(site)->file,siteAt(site)->line,site,__builtin_frame_address(0));
+}
+
+//returns the size that was asked for (not the capacity of the block, so the backpack still catches writes past it), 0 for anything
+//that isn't a live allocation of m61
+size_t m61_malloc_usable_size(void *ptr) {
+    span *s=ptr?addressIsInHeap(ptr):NULL;
+    if(!s)
+        return 0;
+    if(s->arena)
+        return payloadSize(ptr);
+    if(compactMode&&s->blocksz){
+        compactHeader *header=findCompactBlock(s,ptr);
+        uint32_t szflags=header?__atomic_load_n(&records[header->slot].szflags,__ATOMIC_ACQUIRE):0;
+        return szflags&M61_RECORDLIVE&&compactPayload(header,szflags)==ptr?szflags&M61_RECORDSIZE:0;
+    }
+    metadata *meta_ptr=(metadata *)blockContaining(s,ptr);
+    if(!meta_ptr||ptr!=getPayload(meta_ptr)||meta_ptr->self!=meta_ptr||meta_ptr->previously_freed||meta_ptr->sz>blockCapacity(s,meta_ptr))
+        return 0;
+    return meta_ptr->sz;
+}
+
+//m61_free() for a caller that knows the size of the allocation, the free of the level compares it with the size of the block it looks up
+//anyway; a size that doesn't match is reported and the block is freed with its own size
+void freeSizedCall(void *ptr, size_t sz, const char *file, int line, uint32_t site){
+    if(__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+        traceEvent(M61_TRACE_FREE,file,line,0,ptr,NULL,site);
+    __atomic_load_n(&checks,__ATOMIC_ACQUIRE)->free(ptr,sz,file,line,site);
+}
+
+//reports a sized free of the live block ptr whose size isn't the one it was allocated with
+void reportSizeMismatch(void *ptr, size_t sz, size_t allocated, const char *file, int line){
+    fprintf(reportStream(),"MEMORY BUG: %s:%i: free of pointer %p with size %zu, but it was allocated with size %zu\n",file,line,ptr,sz,allocated);
+}
+
+void m61_free_sized(void *ptr, size_t sz, const char *file, int line) {
+    freeSizedCall(ptr,sz,file,line,0);
+}
+
+void m61_free_sized_site(void *ptr, size_t sz, uint32_t site) {
+    freeSizedCall(ptr,sz,siteAt(site)->file,siteAt(site)->line,site);
+}
+
+//maps a chunk for arena that has room for need bytes and puts it in the page map, so that a free of arena memory can be caught
+arenaChunk *newArenaChunk(m61_arena *arena, size_t need){
+    size_t base=(sizeof(arenaChunk)+15)&~(size_t)15;
+    if(need>(size_t)-1-base-pageSize)
+        return NULL;
+    size_t len=largeMappingSize(base+need>M61_ARENACHUNK?base+need:M61_ARENACHUNK);
+    arenaChunk *c=mapMemory(len);
+    if(!c)
+        return NULL;
+    pthread_mutex_lock(&heapLock);
+    span *s=newSpan((char *)c,len,0);
+    if(s)
+        s->arena=arena;
+    pthread_mutex_unlock(&heapLock);
+    if(!s){
+        munmap(c,len);
+        return NULL;
+    }
+    c->len=len;
+    c->base=c->used=(char *)c+base;
+    return c;
+}
+
+void deleteArenaChunk(arenaChunk *c){
+    pthread_mutex_lock(&heapLock);
+    deleteSpan(addressIsInHeap(c));
+    pthread_mutex_unlock(&heapLock);
+    munmap(c,c->len);
+}
+
+//creates an empty arena, the arena itself is kept in its first chunk
+m61_arena *m61_arena_create(void){
+    if(!__atomic_load_n(&m61Initialized,__ATOMIC_ACQUIRE))
+        pthread_once(&initOnce,m61Init);
+    arenaChunk *c=newArenaChunk(NULL,(sizeof(m61_arena)+15)&~(size_t)15);
+    if(!c)
+        return NULL;
+    m61_arena *arena=(m61_arena *)c->base;
+    c->base=c->used=c->base+((sizeof(m61_arena)+15)&~(size_t)15);
+    c->next=NULL;
+    arena->first=arena->current=arena->chunks=c;
+    addressIsInHeap(c)->arena=arena;
+    return arena;
+}
+
+//bumps sz bytes (16 byte aligned) off the current chunk of the arena, the allocation is counted and tracked like one of m61_malloc()
+//but it isn't linked into a list: it can't be freed on its own, and it isn't part of leak reports and snapshots
+//an arena must not be used by two threads at once
+void *m61_arena_alloc(m61_arena *arena, size_t sz, const char *file, int line){
+    threadState *t=currentThread();
+    if(sz>maximumSizeValid()-sizeof(arenaHeader)-15){
+        allocationFailedWithSize(t,sz);
+        if(__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+            traceEvent(M61_TRACE_MALLOC,file,line,sz,NULL,NULL,0);
+        return NULL;
+    }
+    size_t need=sizeof(arenaHeader)+((sz+15)&~(size_t)15);
+    arenaChunk *c=arena->current;
+    if((size_t)((char *)c+c->len-c->used)<need){
+        c=newArenaChunk(arena,need);
+        if(!c){
+            allocationFailedWithSize(t,sz);
+            if(__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+                traceEvent(M61_TRACE_MALLOC,file,line,sz,NULL,NULL,0);
+            return NULL;
+        }
+        c->next=arena->chunks;
+        arena->chunks=c;
+        //a chunk of its own doesn't replace the current chunk, which may still have room
+        if(c->len==M61_ARENACHUNK)
+            arena->current=c;
+    }
+    arenaHeader *header=(arenaHeader *)c->used;
+    c->used+=need;
+    header->sz=sz;
+    header->birth=birthTime(t);
+    header->site=0;
+    if(sampleAllocation(t,sz)){
+        header->site=siteIntern(file,line);
+        uint32_t key=trackingKey(header->site,__builtin_frame_address(0));
+        pthread_mutex_lock(&t->lock);
+        trackAllocByHH(t,sz,key,sampleWeight(sz));
+        pthread_mutex_unlock(&t->lock);
+    }
+    countAllocation(t,sz,header->site,file,line);
+    if(__atomic_load_n(&tracing,__ATOMIC_RELAXED))
+        traceEvent(M61_TRACE_MALLOC,file,line,sz,header+1,NULL,header->site);
+    return header+1;
+}
+
+//frees every allocation of the arena at once: they are counted as frees at file:line, the chunks but the first are unmapped
+void m61_arena_reset(m61_arena *arena, const char *file, int line){
+    threadState *t=currentThread();
+    int traced=__atomic_load_n(&tracing,__ATOMIC_RELAXED);
+    for(arenaChunk *c=arena->chunks,*next;c;c=next){
+        next=c->next;
+        for(char *p=c->base;p<c->used;p+=sizeof(arenaHeader)+((((arenaHeader *)p)->sz+15)&~(size_t)15)){
+            arenaHeader *header=(arenaHeader *)p;
+            if(traced)
+                traceEvent(M61_TRACE_FREE,file,line,0,header+1,NULL,0);
+            countFree(t,header->sz,header->birth,header->site);
+        }
+        if(c!=arena->first)
+            deleteArenaChunk(c);
+    }
+    arena->first->next=NULL;
+    arena->first->used=arena->first->base;
+    arena->current=arena->chunks=arena->first;
+}
+
+void m61_arena_destroy(m61_arena *arena, const char *file, int line){
+    if(!arena)
+        return;
+    m61_arena_reset(arena,file,line);
+    deleteArenaChunk(arena->first);
+}
+
+//merges the statistics shards of all threads, the sums are exact even though a single shard may have wrapped around
+void m61_getstatistics(struct m61_statistics *stats) {
+    memset(stats, 0, sizeof(struct m61_statistics));
+    for(threadState *t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next){
+        stats->total_count+=__atomic_load_n(&t->total_count,__ATOMIC_RELAXED);
+        stats->total_size+=__atomic_load_n(&t->total_size,__ATOMIC_RELAXED);
+        stats->active_size+=__atomic_load_n(&t->active_size,__ATOMIC_RELAXED);
+        stats->active_count+=__atomic_load_n(&t->active_count,__ATOMIC_RELAXED);
+        stats->fail_count+=__atomic_load_n(&t->fail_count,__ATOMIC_RELAXED);
+        stats->fail_size+=__atomic_load_n(&t->fail_size,__ATOMIC_RELAXED);
+        stats->copied_size+=__atomic_load_n(&t->copied_size,__ATOMIC_RELAXED);
+    }
+}
+
+//fills in the histograms of the whole program (file NULL) or of the call site file:line, which is identified like in the reports
+//returns 0, or -1 if there are no histograms for call sites (M61_HISTOGRAMS isn't set)
+//the histograms of a call site only count the allocations that the heavy hitters track, which are the sampled ones in sampling mode
+int m61_gethistograms(struct m61_histograms *histograms, const char *file, int line) {
+    memset(histograms, 0, sizeof(struct m61_histograms));
+    if(!file){
+        for(threadState *t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next){
+            for(int i=0;i<M61_SIZEBUCKETS;++i)
+                histograms->size[i]+=__atomic_load_n(&t->sizeHistogram[i],__ATOMIC_RELAXED);
+            for(int i=0;i<M61_LIFETIMEBUCKETS;++i)
+                histograms->lifetime[i]+=__atomic_load_n(&t->lifetimeHistogram[i],__ATOMIC_RELAXED);
+        }
+        return 0;
+    }
+    if(!__atomic_load_n(&m61Initialized,__ATOMIC_ACQUIRE)||!siteStatistics)
+        return -1;
+    siteStats *site=siteStatsAt(siteIntern(file,line));
+    if(!site)
+        return -1;
+    for(int i=0;i<M61_SIZEBUCKETS;++i)
+        histograms->size[i]=__atomic_load_n(&site->histograms.size[i],__ATOMIC_RELAXED);
+    for(int i=0;i<M61_LIFETIMEBUCKETS;++i)
+        histograms->lifetime[i]=__atomic_load_n(&site->histograms.lifetime[i],__ATOMIC_RELAXED);
+    return 0;
+}
+
+//fills in the peaks of the whole program (file NULL) or of the call site file:line, whose peaks are always set by the site itself
+//the program peaks include the open batch of the calling thread
+//returns 0, or -1 if call sites don't have statistics
+int m61_getpeaks(struct m61_peaks *result, const char *file, int line) {
+    memset(result, 0, sizeof(struct m61_peaks));
+    if(!file){
+        threadState *t=cachingThread();
+        if(t)
+            flushActive(t);
+        pthread_mutex_lock(&peakLock);
+        *result=peaks;
+        pthread_mutex_unlock(&peakLock);
+        return 0;
+    }
+    if(!__atomic_load_n(&m61Initialized,__ATOMIC_ACQUIRE)||!siteStatistics)
+        return -1;
+    siteStats *site=siteStatsAt(siteIntern(file,line));
+    if(!site)
+        return -1;
+    result->count=__atomic_load_n(&site->peak_count,__ATOMIC_RELAXED);
+    result->size=__atomic_load_n(&site->peak_size,__ATOMIC_RELAXED);
+    if(result->count){
+        result->size_file=result->count_file=file;
+        result->size_line=result->count_line=line;
+    }
+    return 0;
+}
+
+void m61_printstatistics(void) {
+    struct m61_statistics stats;
+    m61_getstatistics(&stats);
+
+    fprintf(reportStream(),"malloc count: active %10llu   total %10llu   fail %10llu\n\
+malloc size:  active %10llu   total %10llu   fail %10llu\n",
+    stats.active_count, stats.total_count, stats.fail_count,
+    stats.active_size, stats.total_size, stats.fail_size);
+}
+
+//walks the allocation list segment of one thread from the newest block to the oldest one
+//in sampling mode the list only holds the sampled blocks, objects and bytes add up the leaks they stand for
+void leakTraverse(threadState *t, double *objects, double *bytes){
+    drainRemoteFrees(t);
+    pthread_mutex_lock(&t->lock);
+    for(metadata *ptr=t->lastAlloc;ptr;ptr=ptr->prv){
+        fprintf(reportStream(),"LEAK CHECK: %s:%d: allocated object %p with size %zu\n",siteAt(ptr->site)->file,siteAt(ptr->site)->line,getPayload(ptr),ptr->sz);
+        *objects+=sampleWeight(ptr->sz);
+        *bytes+=sampleWeight(ptr->sz)*ptr->sz;
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+void m61_printleakreport(void) {
+  if(leakSummary){
+      printLeakSummary(leakSummary==2,__builtin_frame_address(0));
+      return;
+  }
+  double objects=0, bytes=0;
+  for(threadState *t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next)
+      leakTraverse(t,&objects,&bytes);
+  if(compactMode)
+      compactLeakReport();
+  if(stackDepth)
+      stackLeakReport();
+  if(!compactMode&&sampleRate)
+      fprintf(reportStream(),"LEAK CHECK: the sampled objects stand for ~%.0f leaked objects with ~%.0f bytes\n",objects,bytes);
+}
+
+//leaks of one call stack, for the aggregated leak report of stack mode
+typedef struct stackLeaks {
+    uint32_t stack;
+    double objects;
+    double bytes;
+}stackLeaks;
+
+int compareStackLeaks(const void *a, const void *b){
+    const stackLeaks *x=a, *y=b;
+    return (x->bytes<y->bytes)-(x->bytes>y->bytes);
+}
+
+//adds up the blocks in the allocation lists by call stack and prints the stacks with the most leaked bytes first
+//compact blocks don't remember their stack, so only blocks with full metadata are counted
+void stackLeakReport(void){
+    uint32_t stacks=__atomic_load_n(&nstacks,__ATOMIC_ACQUIRE)+1;
+    size_t len=stacks*sizeof(stackLeaks);
+    stackLeaks *leaks=mapInternal(len);
+    if(!leaks)
+        return;
+    for(threadState *t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next){
+        drainRemoteFrees(t);
+        pthread_mutex_lock(&t->lock);
+        for(metadata *ptr=t->lastAlloc;ptr;ptr=ptr->prv){
+            if(ptr->key>=stacks)
+                continue;
+            leaks[ptr->key].objects+=sampleWeight(ptr->sz);
+            leaks[ptr->key].bytes+=sampleWeight(ptr->sz)*ptr->sz;
+        }
+        pthread_mutex_unlock(&t->lock);
+    }
+    uint32_t n=0;
+    for(uint32_t i=0;i<stacks;++i){
+        if(leaks[i].objects){
+            leaks[n]=leaks[i];
+            leaks[n++].stack=i;
+        }
+    }
+    qsort(leaks,n,sizeof(stackLeaks),compareStackLeaks);
+    for(uint32_t i=0;i<n;++i){
+        callSite *site=keySite(leaks[i].stack);
+        fprintf(reportStream(),"LEAK CHECK: %s:%d: %.0f objects with %.0f bytes leaked from this stack\n",site->file,site->line,leaks[i].objects,leaks[i].bytes);
+        printStack(leaks[i].stack);
+    }
+    munmap(leaks,len);
+}
+
+//leaks of one call site, lost or still reachable
+typedef struct siteLeaks {
+    uint32_t site;
+    int reachable;
+    double objects;
+    double bytes;
+}siteLeaks;
+
+void m61_printleaksummary(int mark) {
+    printLeakSummary(mark,__builtin_frame_address(0));
+}
+
+//prints the live blocks added up by call site, most bytes first; with mark, the blocks that can't be reached from the roots are printed as
+//definitely lost first, then the rest as still reachable. frame is the frame of the m61 function the user called, the stack above it is a root
+void printLeakSummary(int mark, void **frame){
+    if(!__atomic_load_n(&m61Initialized,__ATOMIC_ACQUIRE))
+        return;
+    //the heap may change between counting and collecting the blocks, blocks beyond the capacity are left out
+    size_t capacity=collectLiveBlocks(NULL,0);
+    capacity+=capacity/4+64;
+    size_t blocksLen=capacity*(sizeof(leakBlock)+sizeof(size_t));
+    leakBlock *blocks=mapInternal(blocksLen);
+    if(!blocks)
+        return;
+    size_t n=collectLiveBlocks(blocks,capacity);
+    if(n>capacity)
+        n=capacity;
+    if(mark){
+        qsort(blocks,n,sizeof(leakBlock),compareLeakBlocks);
+        Dl_info info;
+        leakMark state={blocks,n,(size_t *)(blocks+capacity),0,NULL};
+        if(dladdr((void *)printLeakSummary,&info))
+            state.self=info.dli_fbase;
+        markReachable(&state,frame);
+    }
+
+    uint32_t sites=__atomic_load_n(&nsites,__ATOMIC_ACQUIRE)+1;
+    size_t leaksLen=2*(size_t)sites*sizeof(siteLeaks);
+    siteLeaks *leaks=mapInternal(leaksLen);
+    if(!leaks){
+        munmap(blocks,blocksLen);
+        return;
+    }
+    double total[2][2]={{0,0},{0,0}};
+    for(size_t i=0;i<n;++i){
+        siteLeaks *leak=&leaks[2*(size_t)(blocks[i].site<sites?blocks[i].site:0)+blocks[i].reachable];
+        leak->objects+=blocks[i].weight;
+        leak->bytes+=blocks[i].weight*blocks[i].sz;
+        total[blocks[i].reachable][0]+=blocks[i].weight;
+        total[blocks[i].reachable][1]+=blocks[i].weight*blocks[i].sz;
+    }
+    munmap(blocks,blocksLen);
+    size_t nleaks=0;
+    for(size_t i=0;i<2*(size_t)sites;++i){
+        if(leaks[i].objects){
+            leaks[nleaks]=leaks[i];
+            leaks[nleaks].site=(uint32_t)(i/2);
+            leaks[nleaks++].reachable=(int)(i%2);
+        }
+    }
+    qsort(leaks,nleaks,sizeof(siteLeaks),compareSiteLeaks);
+    for(size_t i=0;i<nleaks;++i){
+        callSite *site=siteAt(leaks[i].site);
+        fprintf(reportStream(),"LEAK SUMMARY: %s:%d: %.0f objects with %.0f bytes %s\n",site->file,site->line,leaks[i].objects,leaks[i].bytes,
+                !mark?"leaked":leaks[i].reachable?"still reachable":"definitely lost");
+    }
+    if(mark)
+        fprintf(reportStream(),"LEAK SUMMARY: %.0f objects with %.0f bytes definitely lost, %.0f objects with %.0f bytes still reachable\n",total[0][0],total[0][1],total[1][0],total[1][1]);
+    else
+        fprintf(reportStream(),"LEAK SUMMARY: %.0f objects with %.0f bytes leaked from %zu call sites\n",total[0][0],total[0][1],nleaks);
+    munmap(leaks,leaksLen);
+}
+
+//stores up to capacity live blocks: the blocks in the allocation lists (the sampled ones in sampling mode) and the compact blocks in the slabs
+//returns how many live blocks there are, blocks can be NULL to just count them
+size_t collectLiveBlocks(leakBlock *blocks, size_t capacity){
+    size_t n=0;
+    for(threadState *t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next){
+        drainRemoteFrees(t);
+        pthread_mutex_lock(&t->lock);
+        for(metadata *ptr=t->lastAlloc;ptr;ptr=ptr->prv,++n){
+            if(n>=capacity)
+                continue;
+            blocks[n]=(leakBlock){getPayload(ptr),ptr->sz,keySiteId(ptr->key),0,sampleWeight(ptr->sz)};
+        }
+        pthread_mutex_unlock(&t->lock);
+    }
+    if(!compactMode)
+        return n;
+    uint32_t slots=__atomic_load_n(&nextSlot,__ATOMIC_ACQUIRE);
+    for(span *slab=__atomic_load_n(&slabs,__ATOMIC_ACQUIRE);slab;slab=slab->next){
+        for(char *block=slab->start;block+slab->blocksz<=slab->start+slab->len;block+=slab->blocksz){
+            compactHeader *header=(compactHeader *)block;
+            if((header->slot^M61_TAGMAGIC)!=header->tag||header->slot>=slots)
+                continue;
+            allocRecord *record=&records[header->slot];
+            uint32_t szflags=__atomic_load_n(&record->szflags,__ATOMIC_ACQUIRE);
+            if(!(szflags&M61_RECORDLIVE))
+                continue;
+            if(n<capacity)
+                blocks[n]=(leakBlock){compactPayload(header,szflags),szflags&M61_RECORDSIZE,record->site,0,1};
+            ++n;
+        }
+    }
+    return n;
+}
+
+int compareLeakBlocks(const void *a, const void *b){
+    const leakBlock *x=a, *y=b;
+    return (x->start>y->start)-(x->start<y->start);
+}
+
+//definitely lost before still reachable, then the most bytes first
+int compareSiteLeaks(const void *a, const void *b){
+    const siteLeaks *x=a, *y=b;
+    if(x->reachable!=y->reachable)
+        return x->reachable-y->reachable;
+    return (x->bytes<y->bytes)-(x->bytes>y->bytes);
+}
+
+//marks the blocks that an aligned word in [start,end) points into (interior pointers count) and queues them to be scanned themselves
+void markRange(leakMark *mark, const char *start, const char *end){
+    const uintptr_t *word=(const uintptr_t *)(((uintptr_t)start+sizeof(uintptr_t)-1)&~(uintptr_t)(sizeof(uintptr_t)-1));
+    for(;(const char *)(word+1)<=end;++word){
+        uintptr_t value=*word;
+        //the page map weeds out most words before the binary search
+        if(!addressIsInHeap((void *)value))
+            continue;
+        size_t low=0, high=mark->nblocks;
+        while(low<high){
+            size_t mid=(low+high)/2;
+            if((uintptr_t)mark->blocks[mid].start<=value)
+                low=mid+1;
+            else
+                high=mid;
+        }
+        if(!low)
+            continue;
+        leakBlock *block=&mark->blocks[low-1];
+        if(block->reachable||value>=(uintptr_t)block->start+(block->sz?block->sz:1))
+            continue;
+        block->reachable=1;
+        mark->pending[mark->npending++]=low-1;
+    }
+}
+
+//marks from the writable segments of the program and its libraries, which hold the data and bss sections
+int markSegments(struct dl_phdr_info *info, size_t size, void *data){
+    (void) size;
+    leakMark *mark=data;
+    if(info->dlpi_name&&info->dlpi_name[0]&&(void *)info->dlpi_addr==mark->self)
+        return 0;
+    for(int i=0;i<info->dlpi_phnum;++i){
+        const ElfW(Phdr) *phdr=&info->dlpi_phdr[i];
+        if(phdr->p_type==PT_LOAD&&phdr->p_flags&PF_W){
+            const char *start=(const char *)(info->dlpi_addr+phdr->p_vaddr);
+            markRange(mark,start,start+phdr->p_memsz);
+        }
+    }
+    return 0;
+}
+
+//marks from the stacks: the calling thread's stack above frame and the whole stacks of the other threads that have a shard
+//the main thread's stack can only be scanned by the main thread itself, its lower end isn't known to other threads
+void markStacks(leakMark *mark, void **frame){
+    for(threadState *t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next){
+        int self=pthread_equal(t->thread,pthread_self());
+        if(__atomic_load_n(&t->retired,__ATOMIC_ACQUIRE)||(t->mainThread&&!self))
+            continue;
+        pthread_attr_t attr;
+        void *stack;
+        size_t stackSize;
+        if(pthread_getattr_np(t->thread,&attr))
+            continue;
+        if(!pthread_attr_getstack(&attr,&stack,&stackSize)){
+            const char *low=self?(const char *)frame:(const char *)stack;
+            markRange(mark,low,(const char *)stack+stackSize);
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+//conservative mark phase: every word in the roots or in a reachable payload that points into a live block makes that block reachable
+//the worklist keeps the walk iterative however long the chains of blocks are; memory that m61 doesn't know about (thread-local storage, the
+//libc heap, other mappings) isn't scanned, and in sampling mode blocks that weren't sampled are neither marked nor scanned
+void markReachable(leakMark *mark, void **frame){
+    jmp_buf registers;      //pointers that only live in callee-saved registers of the callers are spilled here
+    setjmp(registers);
+    markRange(mark,(const char *)&registers,(const char *)(&registers+1));
+    dl_iterate_phdr(markSegments,mark);
+    markStacks(mark,frame);
+    while(mark->npending){
+        leakBlock *block=&mark->blocks[mark->pending[--mark->npending]];
+        markRange(mark,block->start,block->start+block->sz);
+    }
+}
+
+//live allocations of a call site while a snapshot is taken
+typedef struct siteLive {
+    double objects;
+    double bytes;
+}siteLive;
+
+//change of the live allocations of a call site between two snapshots
+typedef struct siteGrowth {
+    const struct m61_snapshot_site *site;   //the site in the later snapshot
+    long long count;
+    long long size;
+}siteGrowth;
+
+size_t snapshotLength(size_t nsites){
+    return sizeof(struct m61_snapshot)+nsites*sizeof(struct m61_snapshot_site);
+}
+
+int compareSnapshotSites(const void *a, const void *b){
+    const struct m61_snapshot_site *x=a, *y=b;
+    return (x->size<y->size)-(x->size>y->size);
+}
+
+int compareSiteGrowth(const void *a, const void *b){
+    const siteGrowth *x=a, *y=b;
+    if(x->size!=y->size)
+        return (x->size<y->size)-(x->size>y->size);
+    return (x->count<y->count)-(x->count>y->count);
+}
+
+//adds up the live allocations by call site, from the allocation lists (the sampled blocks in sampling mode) and the compact blocks in the slabs
+//returns the snapshot (to be freed with m61_snapshot_free()) or NULL if there is no memory for it; the program keeps running meanwhile,
+//so the snapshot is only exact if no other thread allocates or frees
+struct m61_snapshot *m61_snapshot(void) {
+    uint32_t sites=__atomic_load_n(&nsites,__ATOMIC_ACQUIRE)+1;
+    size_t len=sites*sizeof(siteLive);
+    siteLive *live=mapInternal(len);
+    if(!live)
+        return NULL;
+    for(threadState *t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next){
+        drainRemoteFrees(t);
+        pthread_mutex_lock(&t->lock);
+        for(metadata *ptr=t->lastAlloc;ptr;ptr=ptr->prv){
+            uint32_t site=keySiteId(ptr->key);
+            if(site>=sites)
+                continue;
+            live[site].objects+=sampleWeight(ptr->sz);
+            live[site].bytes+=sampleWeight(ptr->sz)*ptr->sz;
+        }
+        pthread_mutex_unlock(&t->lock);
+    }
+    if(compactMode){
+        uint32_t slots=__atomic_load_n(&nextSlot,__ATOMIC_ACQUIRE);
+        for(span *slab=__atomic_load_n(&slabs,__ATOMIC_ACQUIRE);slab;slab=slab->next){
+            for(char *block=slab->start;block+slab->blocksz<=slab->start+slab->len;block+=slab->blocksz){
+                compactHeader *header=(compactHeader *)block;
+                if((header->slot^M61_TAGMAGIC)!=header->tag||header->slot>=slots)
+                    continue;
+                allocRecord *record=&records[header->slot];
+                uint32_t szflags=__atomic_load_n(&record->szflags,__ATOMIC_ACQUIRE);
+                if(!(szflags&M61_RECORDLIVE)||record->site>=sites)
+                    continue;
+                live[record->site].objects+=1;
+                live[record->site].bytes+=szflags&M61_RECORDSIZE;
+            }
+        }
+    }
+    size_t n=0;
+    for(uint32_t i=0;i<sites;++i)
+        n+=live[i].objects>0;
+    struct m61_snapshot *snapshot=mapInternal(snapshotLength(n));
+    if(snapshot){
+        snapshot->nsites=n;
+        struct m61_snapshot_site *out=snapshot->sites;
+        for(uint32_t i=0;i<sites;++i){
+            if(!(live[i].objects>0))
+                continue;
+            out->file=siteAt(i)->file;
+            out->line=siteAt(i)->line;
+            out->count=(unsigned long long)(live[i].objects+0.5);
+            out->size=(unsigned long long)(live[i].bytes+0.5);
+            ++out;
+        }
+        qsort(snapshot->sites,n,sizeof(struct m61_snapshot_site),compareSnapshotSites);
+    }
+    munmap(live,len);
+    return snapshot;
+}
+
+//prints the call sites whose live allocations grew from snapshot a to snapshot b, the most bytes of growth first, and returns how many there are
+int m61_snapshot_diff(const struct m61_snapshot *a, const struct m61_snapshot *b) {
+    if(!a||!b)
+        return 0;
+    size_t len=b->nsites*sizeof(siteGrowth);
+    siteGrowth *growth=len?mapInternal(len):NULL;
+    if(len&&!growth)
+        return 0;
+    //snapshots are sorted by size, the sites of a are looked up through their interned ids in a table of the sites of b
+    uint32_t sites=__atomic_load_n(&nsites,__ATOMIC_ACQUIRE)+1;
+    size_t indexLen=sites*sizeof(uint32_t);
+    uint32_t *index=mapInternal(indexLen);
+    if(!index){
+        if(growth)
+            munmap(growth,len);
+        return 0;
+    }
+    for(size_t i=0;i<b->nsites;++i){
+        growth[i].site=&b->sites[i];
+        growth[i].count=(long long)b->sites[i].count;
+        growth[i].size=(long long)b->sites[i].size;
+        uint32_t id=siteIntern(b->sites[i].file,b->sites[i].line);
+        if(id&&id<sites)
+            index[id]=(uint32_t)i+1;
+    }
+    for(size_t i=0;i<a->nsites;++i){
+        uint32_t id=siteIntern(a->sites[i].file,a->sites[i].line);
+        if(id&&id<sites&&index[id]){
+            growth[index[id]-1].count-=(long long)a->sites[i].count;
+            growth[index[id]-1].size-=(long long)a->sites[i].size;
+        }
+    }
+    munmap(index,indexLen);
+    size_t n=0;
+    for(size_t i=0;i<b->nsites;++i)
+        if(growth[i].count>0||growth[i].size>0)
+            growth[n++]=growth[i];
+    qsort(growth,n,sizeof(siteGrowth),compareSiteGrowth);
+    for(size_t i=0;i<n;++i)
+        fprintf(reportStream(),"SNAPSHOT DIFF: %s:%d: %+lld objects, %+lld bytes (%llu objects with %llu bytes live)\n",growth[i].site->file,growth[i].site->line,growth[i].count,growth[i].size,growth[i].site->count,growth[i].site->size);
+    if(growth)
+        munmap(growth,len);
+    return (int)n;
+}
+
+void m61_snapshot_free(struct m61_snapshot *snapshot) {
+    if(snapshot)
+        munmap(snapshot,snapshotLength(snapshot->nsites));
+}
+
+void printHeavyHitterReport(void){
+    struct m61_statistics stats;
+    m61_getstatistics(&stats);
+    if(!stats.total_count)
+        return;
+    int freqElements, szElements;
+    hitTracker *freqTracker=mergeHitTrackers(0,&freqElements);
+    hitTracker *szTracker=mergeHitTrackers(1,&szElements);
+
+    fprintf(reportStream(),"---------------Heavy Hitter Report-----------------\n");
+    if(freqTracker)
+        printHitTrackers(freqTracker,freqElements,stats.total_count,"allocations");
+    if(szTracker)
+        printHitTrackers(szTracker,szElements,stats.total_size,"bytes");
+    if(printHistograms){
+        struct m61_histograms histograms;
+        m61_gethistograms(&histograms,NULL,0);
+        printHistogram("HISTOGRAM: sizes:",histograms.size,M61_SIZEBUCKETS);
+        printHistogram("HISTOGRAM: lifetimes:",histograms.lifetime,M61_LIFETIMEBUCKETS);
+    }
+    if(printPeaks){
+        struct m61_peaks peak;
+        m61_getpeaks(&peak,NULL,0);
+        fprintf(reportStream(),"PEAK: %llu active allocations, reached by an allocation at %s:%d\n",peak.count,peak.count_file,peak.count_line);
+        fprintf(reportStream(),"PEAK: %llu active bytes, reached by an allocation at %s:%d\n",peak.size,peak.size_file,peak.size_line);
+    }
+    fprintf(reportStream(),"---------------------------------------------------\n");
+    if(freqTracker)
+        munmap(freqTracker,freqElements?freqElements*sizeof(hitTracker):1);
+    if(szTracker)
+        munmap(szTracker,szElements?szElements*sizeof(hitTracker):1);
+}
+
+//prints the merged counters that are above the report threshold, together with their error bound
+void printHitTrackers(hitTracker *merged, int elements, unsigned long long total, const char *unit){
+    double threshold=theta<REPORTTHRESHOLD?theta:REPORTTHRESHOLD;
+    for(int i=0;i<elements;++i){
+        unsigned long long count=merged[i].counter;
+        unsigned long long error=merged[i].error;
+        if(count<threshold/100*total)
+            break;
+        callSite *site=keySite(merged[i].site);
+        fprintf(reportStream(),"HEAVY HITTER: %s:%d: %llu %s (~%d%%, error <= %llu)\n",site->file,site->line,count,unit,(int)(count*100/total),error);
+        printStack(merged[i].site);
+        siteStats *stats=siteStatsAt(keySiteId(merged[i].site));
+        if(stats&&printHistograms){
+            printHistogram("  sizes:",stats->histograms.size,M61_SIZEBUCKETS);
+            printHistogram("  lifetimes:",stats->histograms.lifetime,M61_LIFETIMEBUCKETS);
+        }
+        if(stats&&printPeaks)
+            fprintf(reportStream(),"  peak: %llu allocations, %llu bytes\n",__atomic_load_n(&stats->peak_count,__ATOMIC_RELAXED),__atomic_load_n(&stats->peak_size,__ATOMIC_RELAXED));
+    }
+}
+
+//prints the buckets of a histogram that aren't empty on one line, as low-high:count
+void printHistogram(const char *title, const unsigned long long *buckets, int n){
+    fprintf(reportStream(),"%s",title);
+    for(int i=0;i<n;++i){
+        if(!buckets[i])
+            continue;
+        unsigned long long low=i?1ULL<<(i-1):0, high=(1ULL<<i)-1;
+        if(n==M61_SIZEBUCKETS&&i==n-1)
+            fprintf(reportStream()," %llu+:%llu",low,buckets[i]);
+        else if(low==high)
+            fprintf(reportStream()," %llu:%llu",low,buckets[i]);
+        else
+            fprintf(reportStream()," %llu-%llu:%llu",low,high,buckets[i]);
+    }
+    fprintf(reportStream(),"\n");
+}
+
+//wrapper function which initializes the summaries of the thread and passes them to updateCounters
+//a sampled allocation counts weight times, called with the lock of the thread's shard held
+void trackAllocByHH(threadState *t, size_t sz, uint32_t site, double weight){
+    if(!t->szTracker.capacity&&(!initSummary(&t->szTracker,numberCounters)||!initSummary(&t->freqTracker,numberCounters)))
+        return;
+    if(weight==1){
+        updateCounters(&t->szTracker,sz,site); 
+        updateCounters(&t->freqTracker,1,site); 
+        return;
+    }
+    updateCounters(&t->szTracker,roundRandomly(t,weight*sz),site);
+    updateCounters(&t->freqTracker,roundRandomly(t,weight),site);
+}
+
+//allocates the counters, the heap and the hash index of a summary with the given number of counters
+int initSummary(hitSummary *summary, int capacity){
+    int buckets=1;
+    while(buckets<2*capacity)
+        buckets*=2;
+    char *mem=allocateInternal(capacity*sizeof(hitTracker)+capacity*sizeof(int)+buckets*sizeof(int));
+    if(!mem)
+        return 0;
+    summary->counters=(hitTracker *)mem;
+    summary->heap=(int *)(mem+capacity*sizeof(hitTracker));
+    summary->buckets=summary->heap+capacity;
+    summary->mask=buckets-1;
+    summary->elements=0;
+    summary->capacity=capacity;
+    return 1;
+}
+
+//restores the heap order below pos after the counter at pos grew
+void siftDown(hitSummary *summary, int pos){
+    int *heap=summary->heap;
+    hitTracker *counters=summary->counters;
+    for(;;){
+        int smallest=pos;
+        int left=2*pos+1, right=2*pos+2;
+        if(left<summary->elements&&counters[heap[left]].counter<counters[heap[smallest]].counter)
+            smallest=left;
+        if(right<summary->elements&&counters[heap[right]].counter<counters[heap[smallest]].counter)
+            smallest=right;
+        if(smallest==pos)
+            return;
+        int tmp=heap[pos];
+        heap[pos]=heap[smallest];
+        heap[smallest]=tmp;
+        counters[heap[pos]].heapPos=pos;
+        counters[heap[smallest]].heapPos=smallest;
+        pos=smallest;
+    }
+}
+
+//moves a new counter at pos up to its place in the heap
+void siftUp(hitSummary *summary, int pos){
+    int *heap=summary->heap;
+    hitTracker *counters=summary->counters;
+    while(pos>0&&counters[heap[(pos-1)/2]].counter>counters[heap[pos]].counter){
+        int parent=(pos-1)/2;
+        int tmp=heap[pos];
+        heap[pos]=heap[parent];
+        heap[parent]=tmp;
+        counters[heap[pos]].heapPos=pos;
+        counters[heap[parent]].heapPos=parent;
+        pos=parent;
+    }
+}
+
+//Space-Saving: a tracked site just gets the occurrence added, an untracked site takes over the smallest counter
+//the smallest counter becomes the error of the new site; a site is found through the hash index in O(1)
+//and since counters only grow, the heap only has to be fixed downwards (heavy hitters sit at the bottom of the heap, so that's usually a no-op)
+//occurrence is either 1 (for count) or the size
+void updateCounters(hitSummary *summary, size_t occurrence, uint32_t site){
+    hitTracker *counters=summary->counters;
+    int bucket=(int)(site*2654435761u)&summary->mask;
+    for(int i=summary->buckets[bucket];i;i=counters[i-1].chain){
+        if(counters[i-1].site==site){
+            counters[i-1].counter+=occurrence;
+            siftDown(summary,counters[i-1].heapPos);
+            return;
+        }
+    }
+    hitTracker *tracker;
+    if(summary->elements<summary->capacity){
+        int index=summary->elements++;
+        tracker=&counters[index];
+        tracker->counter=occurrence;
+        tracker->error=0;
+        tracker->heapPos=index;
+        summary->heap[index]=index;
+        siftUp(summary,index);
+    }
+    else{
+        //evict the site with the smallest counter and unlink it from its bucket
+        tracker=&counters[summary->heap[0]];
+        int *link=&summary->buckets[(int)(tracker->site*2654435761u)&summary->mask];
+        while(*link!=summary->heap[0]+1)
+            link=&counters[*link-1].chain;
+        *link=tracker->chain;
+        tracker->error=tracker->counter;
+        tracker->counter+=occurrence;
+        siftDown(summary,0);
+    }
+    tracker->site=site;
+    tracker->chain=summary->buckets[bucket];
+    summary->buckets[bucket]=(int)(tracker-counters)+1;
+}
+
+//merges the size (or frequency) summaries of all threads, counters and errors of the same call site are added up
+//a site that isn't tracked by a full summary may have occurred up to that summary's smallest counter there, which is added as well
+//returns the merged counters sorted by count (*elements of them, to be unmapped by the caller)
+hitTracker *mergeHitTrackers(int sizeTracker, int *elements){
+    size_t capacity=0;
+    for(threadState *t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next)
+        capacity+=(size_t)numberCounters;
+    int buckets=1;
+    while((size_t)buckets<2*capacity)
+        buckets*=2;
+    //per merged counter: the sum of the minimums of the summaries that track its site
+    size_t len=capacity*(sizeof(hitTracker)+sizeof(unsigned long long))+buckets*sizeof(int);
+    char *mem=mapInternal(len);
+    if(!mem)
+        return NULL;
+    hitTracker *all=(hitTracker *)mem;
+    unsigned long long *trackedMinimum=(unsigned long long *)(all+capacity);
+    int *index=(int *)(trackedMinimum+capacity);
+    unsigned long long minimumSum=0;
+    *elements=0;
+    for(threadState *t=__atomic_load_n(&threads,__ATOMIC_ACQUIRE);t;t=t->next){
+        pthread_mutex_lock(&t->lock);
+        hitSummary *summary=sizeTracker?&t->szTracker:&t->freqTracker;
+        unsigned long long minimum=0;
+        if(summary->capacity&&summary->elements==summary->capacity)
+            minimum=summary->counters[summary->heap[0]].counter;
+        minimumSum+=minimum;
+        for(int i=0;i<summary->elements&&(size_t)*elements<capacity;++i){
+            hitTracker *tracker=&summary->counters[i];
+            int bucket=(int)(tracker->site*2654435761u)&(buckets-1);
+            while(index[bucket]&&all[index[bucket]-1].site!=tracker->site)
+                bucket=(bucket+1)&(buckets-1);
+            if(!index[bucket]){
+                all[*elements].site=tracker->site;
+                index[bucket]=++*elements;
+            }
+            all[index[bucket]-1].counter+=tracker->counter;
+            all[index[bucket]-1].error+=tracker->error;
+            trackedMinimum[index[bucket]-1]+=minimum;
+        }
+        pthread_mutex_unlock(&t->lock);
+    }
+    for(int i=0;i<*elements;++i){
+        all[i].counter+=minimumSum-trackedMinimum[i];
+        all[i].error+=minimumSum-trackedMinimum[i];
+    }
+    sortHitTracker(all,*elements);
+    //only the merged counters at the start of the mapping are kept, the caller unmaps them
+    size_t kept=(*elements*sizeof(hitTracker)+pageSize-1)&~(pageSize-1);
+    if(!kept)
+        kept=pageSize;
+    if(len>kept)
+        munmap(mem+kept,len-kept);
+    return all;
+}
+
+int compareHitTrackers(const void *a, const void *b){
+    const hitTracker *x=a, *y=b;
+    return x->counter<y->counter?1:x->counter>y->counter?-1:0;
+}
+
+//sort the Array of Counters by count
+void sortHitTracker(hitTracker *tracker, int elements){
+    qsort(tracker,elements,sizeof(hitTracker),compareHitTrackers);
 }
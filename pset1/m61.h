@@ -1,11 +1,41 @@
 #ifndef M61_H
 #define M61_H 1
 #include <stdlib.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdio.h>
 
 void *m61_malloc(size_t sz, const char *file, int line);
 void m61_free(void *ptr, const char *file, int line);
 void *m61_realloc(void *ptr, size_t sz, const char *file, int line);
 void *m61_calloc(size_t nmemb, size_t sz, const char *file, int line);
+void *m61_memalign(size_t alignment, size_t sz, const char *file, int line);
+int m61_posix_memalign(void **memptr, size_t alignment, size_t sz, const char *file, int line);
+void *m61_aligned_alloc(size_t alignment, size_t sz, const char *file, int line);
+size_t m61_malloc_usable_size(void *ptr);
+void m61_free_sized(void *ptr, size_t sz, const char *file, int line);
+
+//the same functions with the call site given as an id of m61_intern_site()
+uint32_t m61_intern_site(uint32_t *cache, const char *file, int line);
+void *m61_malloc_site(size_t sz, uint32_t site);
+void m61_free_site(void *ptr, uint32_t site);
+void *m61_realloc_site(void *ptr, size_t sz, uint32_t site);
+void *m61_calloc_site(size_t nmemb, size_t sz, uint32_t site);
+void *m61_memalign_site(size_t alignment, size_t sz, uint32_t site);
+int m61_posix_memalign_site(void **memptr, size_t alignment, size_t sz, uint32_t site);
+void *m61_aligned_alloc_site(size_t alignment, size_t sz, uint32_t site);
+void m61_free_sized_site(void *ptr, size_t sz, uint32_t site);
+
+//id of the call site __FILE__:__LINE__, interned by the first call and cached per expansion of the macro, so later calls cost a load
+//the cache is a static variable, which C99 doesn't allow in an inline function that isn't static; a file that allocates in one
+//defines M61_NO_SITE_CACHE before it includes m61.h, then every call interns the site again (a lookup in the site index)
+#if M61_NO_SITE_CACHE
+#define M61_SITE() m61_intern_site(NULL,__FILE__,__LINE__)
+#else
+#define M61_SITE() __extension__({ static uint32_t m61_site_; uint32_t m61_id_=__atomic_load_n(&m61_site_,__ATOMIC_RELAXED); \
+    m61_id_?m61_id_:m61_intern_site(&m61_site_,__FILE__,__LINE__); })
+#endif
 
 struct m61_statistics {
     unsigned long long active_count;	//# active allocations
@@ -14,15 +44,20 @@ struct m61_statistics {
     unsigned long long total_size;	    //# bytes in total allocations
     unsigned long long fail_count;	    //# failed allocation attempts
     unsigned long long fail_size;	    //# bytes in failed alloc attempts
+    unsigned long long copied_size;	    //# bytes copied by realloc
 };
 
 typedef struct metadata {
     struct metadata *prv;
     struct metadata *next;
     size_t sz;
-    double previously_freed; //This ensures a correct alignment
-    const char *file;
-    int line;
+    struct threadState *owner;  //thread whose allocation list segment the block is linked into
+    uint32_t site;              //call site of the allocation
+    uint32_t freedSite;         //call site of the free, once the block is freed
+    int previously_freed;
+    int reported;               //set once the sweeper reported a wild write past the end of the block
+    uint32_t key;               //heavy hitter key of the allocation (its call stack in stack mode, its call site otherwise), 0 if it wasn't sampled
+    uint32_t birth;             //lifetime clock at the allocation
     struct metadata *self;
 }metadata;
 
@@ -30,22 +65,309 @@ typedef struct backpack {
     struct backpack *self; 
 }backpack;
 
+//In compact mode (M61_COMPACT=1) small blocks only carry this header in front of the payload
+//everything else about the allocation lives in the allocRecord for the slot
+typedef struct compactHeader {
+    uint32_t slot;      //index of the block in the table of allocation records, never changes
+    uint32_t tag;       //slot^M61_TAGMAGIC, marks the header as valid
+}compactHeader;
+
+typedef struct allocRecord {
+    uint32_t site;      //id of the call site that allocated the block (or freed it, once it is freed)
+    uint32_t szflags;   //size of the payload in the low 30 bits, M61_RECORD* flags in the high bits
+    uint32_t birth;     //lifetime clock at the allocation
+}allocRecord;
+
+typedef struct callSite {
+    const char *file;
+    int line;
+}callSite;
+
+//entry of the site index, the file name pointer and line of a call site that were interned to the id
+typedef struct siteEntry {
+    const char *file;
+    int line;
+    uint32_t id;    //0 marks an empty entry, written last
+}siteEntry;
+
+typedef struct siteTable {
+    uint32_t capacity;
+    siteEntry entries[];
+}siteTable;
+
+#define M61_MAXFRAMES 16
+
+//In stack mode (M61_STACKS=<depth>) allocations are tracked by call stack, a stack is interned into a 32 bit id like a call site
+typedef struct callStack {
+    uint32_t site;              //call site that was passed to m61_malloc()
+    uint32_t depth;
+    void *frames[M61_MAXFRAMES];    //return addresses, starting with the caller of m61_malloc()
+}callStack;
+
+//a span is either a slab of one size class or the mapping of a single large block
+//every page of a span points to its descriptor in the page map
+typedef struct span {
+    char *start;
+    size_t len;
+    size_t blocksz;         //size of the blocks of a slab, 0 for a large block
+    char *block;            //the block of a large span, a guarded block doesn't start at the start of its mapping
+    int guarded;            //the large block ends at a guard page and has no backpack
+    struct m61_arena *arena;    //the arena that the span is a chunk of, NULL for heap spans
+    struct span *next;      //slabs are linked together, unused descriptors are kept in a free list
+}span;
+
+//a freed block that is held back from reuse in the quarantine (M61_QUARANTINE), its payload is poisoned
+typedef struct quarantineEntry {
+    void *block;
+    size_t blocksz;         //size that is passed to freeBlock() once the block leaves the quarantine
+    unsigned char *payload;
+    size_t sz;
+    int compact;            //the block has a compactHeader, the site of the free is in its record
+}quarantineEntry;
+
+//a live block for the leak summary
+typedef struct leakBlock {
+    char *start;            //payload
+    size_t sz;
+    uint32_t site;
+    int reachable;
+    double weight;          //allocations that the block stands for in sampling mode
+}leakBlock;
+
+//state of the mark phase: the live blocks sorted by address, and the reachable blocks whose payloads still have to be scanned
+typedef struct leakMark {
+    leakBlock *blocks;
+    size_t nblocks;
+    size_t *pending;
+    size_t npending;
+    void *self;             //base address of libm61.so, its data isn't scanned (m61 linked into the program has no data of its own to skip)
+}leakMark;
+
+//An arena hands out memory from chunks of its own with a bump pointer, everything is released at once by m61_arena_reset()
+//every allocation has an arenaHeader in front of it, so that the reset can count the frees like m61_free() does
+typedef struct arenaChunk {
+    struct arenaChunk *next;
+    size_t len;             //length of the mapping
+    char *base;             //first allocation of the chunk
+    char *used;             //end of the allocations
+}arenaChunk;
+
+typedef struct arenaHeader {
+    size_t sz;
+    uint32_t site;
+    uint32_t birth;         //lifetime clock at the allocation
+}arenaHeader;
+
+//the arena lives in its first chunk, which is kept by a reset
+typedef struct m61_arena {
+    arenaChunk *first;
+    arenaChunk *current;    //chunk that small allocations come from
+    arenaChunk *chunks;     //all chunks
+}m61_arena;
+
+typedef struct sizeClass {
+    pthread_mutex_t lock;   //protects the free list and the current slab of the class
+    size_t blocksz;         //size of every block in this class (header+payload+backpack, rounded up)
+    void *freeList;         //freed blocks of this class, linked through the second word of the block (metadata->next)
+    char *bump;             //next block of the current slab that was never handed out
+    char *slabEnd;          //end of the last whole block in the current slab
+}sizeClass;
+
+//one counter of a Space-Saving summary, counter overestimates the true count of the site by at most error
 typedef struct hitTracker {
     unsigned long long counter;
+    unsigned long long error;
+    uint32_t site;
+    int heapPos;                //position of the counter in the min-heap of the summary
+    int chain;                  //next counter in the same hash bucket (index+1, 0 ends the chain)
+}hitTracker;
+
+//Space-Saving stream summary: a fixed number of counters in a min-heap with a hash index on the call site
+typedef struct hitSummary {
+    int capacity;
+    int elements;
+    hitTracker *counters;       //counters never move, the heap and the buckets refer to them by index
+    int *heap;                  //min-heap of counter indexes, ordered by counter
+    int *buckets;               //hash index on the site (counter index+1, 0 is empty)
+    int mask;
+}hitSummary;
+
+//The allocation trace (M61_TRACE=<file>) starts with the 8 bytes "M61TRACE", a 32 bit version and a 32 bit header size.
+//It is followed by chunks of events of one thread: a 32 bit length (of the events), a 32 bit thread id and a 64 bit timestamp in ns.
+//Every event starts with one of the ops below, the numbers after it are unsigned LEB128 varints:
+//  MALLOC, CALLOC: time since the previous event of the thread, site, size, token of the payload (0 if the allocation failed)
+//  FREE: time, site, token
+//  REALLOC: time, site, size, token of the old payload, token of the new payload
+//  SITE: site id, line, length of the file name, the file name (sites are defined before their first event in the same thread)
+//A token is the address of a payload shifted right by 3 bits.
+#define M61_TRACE_MALLOC 1
+#define M61_TRACE_FREE 2
+#define M61_TRACE_REALLOC 3
+#define M61_TRACE_CALLOC 4
+#define M61_TRACE_SITE 5
+#define M61_TRACE_VERSION 1
+
+//allocation sizes are counted in log2 buckets: bucket i counts the sizes of i bits, [2^(i-1), 2^i), bucket 0 counts size 0
+//the last bucket also counts everything bigger
+#define M61_SIZEBUCKETS 48
+
+//lifetimes are measured on a 32 bit clock that ticks once per allocation of any thread, with M61_CLOCK=tsc it counts units of 1024 TSC cycles
+//instead (on x86); they are counted in log2 buckets like the sizes, a lifetime of 2^31 ticks or more wraps around
+#define M61_LIFETIMEBUCKETS 32
+
+struct m61_histograms {
+    unsigned long long size[M61_SIZEBUCKETS];           //allocations by size
+    unsigned long long lifetime[M61_LIFETIMEBUCKETS];   //freed allocations by lifetime
+};
+
+//the most bytes and allocations that were active at any time, with the call sites of the allocations that set these peaks
+struct m61_peaks {
+    unsigned long long size;
+    unsigned long long count;
+    const char *size_file;      //NULL if nothing was allocated yet
+    int size_line;
+    const char *count_file;
+    int count_line;
+};
+
+//live allocations of one call site in a snapshot, in sampling mode the numbers are the estimates that the sampled allocations stand for
+struct m61_snapshot_site {
     const char *file;
     int line;
-}hitTracker;
+    unsigned long long count;
+    unsigned long long size;
+};
+
+//the live allocations at one point in time aggregated by call site, most bytes first
+struct m61_snapshot {
+    size_t nsites;
+    struct m61_snapshot_site sites[];
+};
+
+//statistics of a call site, kept with M61_HISTOGRAMS, M61_PEAKS or M61_TIMELINE; the counters are shared by all threads
+typedef struct siteStats {
+    struct m61_histograms histograms;
+    unsigned long long active_count;
+    unsigned long long active_size;
+    unsigned long long peak_count;
+    unsigned long long peak_size;
+}siteStats;
+
+//With M61_STATS=<name> m61 publishes its statistics in the POSIX shared memory object name (M61_STATS=1 picks /m61.<pid>),
+//a thread rewrites the page every M61_STATS_INTERVAL milliseconds (1000 by default). Readers such as m61stat copy the page and
+//check that sequence was even and unchanged around the copy, m61 makes it odd while it writes.
+#define M61_STATS_MAGIC "M61STATS"
+#define M61_STATS_VERSION 3
+#define M61_STATS_SITES 16
+#define M61_STATS_SITENAME 96
+
+struct m61_stats_site {
+    char file[M61_STATS_SITENAME];  //cut off if longer
+    int line;
+    unsigned long long count;       //allocations or bytes, overestimated by at most error
+    unsigned long long error;
+};
+
+struct m61_stats_page {
+    char magic[8];
+    uint32_t version;
+    uint32_t pid;
+    uint64_t sequence;
+    uint64_t updates;
+    uint64_t time;                  //CLOCK_MONOTONIC in ns when the page was written
+    struct m61_statistics stats;
+    unsigned long long peak_count;
+    unsigned long long peak_size;
+    unsigned long long size_histogram[M61_SIZEBUCKETS];
+    unsigned long long lifetime_histogram[M61_LIFETIMEBUCKETS];
+    uint32_t nfrequent;             //heavy hitters by allocations, most first
+    uint32_t nbig;                  //heavy hitters by bytes
+    struct m61_stats_site frequent[M61_STATS_SITES];
+    struct m61_stats_site big[M61_STATS_SITES];
+};
+
+#define M61_NCLASSES 40
+
+//Every thread keeps its own shard of the statistics, its own segment of the allocation list and its own heavy hitter trackers.
+//The counters are only written by the owning thread, the reports merge all shards.
+typedef struct threadState {
+    unsigned long long active_count;
+    unsigned long long active_size;
+    unsigned long long total_count;
+    unsigned long long total_size;
+    unsigned long long fail_count;
+    unsigned long long fail_size;
+    unsigned long long copied_size;
+    unsigned long long sizeHistogram[M61_SIZEBUCKETS];
+    unsigned long long lifetimeHistogram[M61_LIFETIMEBUCKETS];
+    uint32_t clockNext;         //next tick of the allocation clock that the thread hands out
+    uint32_t clockEnd;          //end of the ticks that the thread took from the global clock
+    long long unflushedCount;   //changes of the active allocations and bytes that weren't added to the global counters of the peaks yet
+    long long unflushedSize;
+    struct m61_peaks batchPeak; //highest unflushed changes since the last flush and the allocations that reached them
+    pthread_t thread;           //thread that uses the shard, its stack is scanned by the mark phase of the leak summary
+    int mainThread;
+    pthread_mutex_t lock;       //protects the allocation list segment and the trackers
+    metadata *lastAlloc;        //last block of the allocation list segment
+    metadata *remoteFrees;      //blocks of the segment that other threads freed, linked through self; pushed without a lock, taken under lock
+    metadata *sweepCursor;      //next block that the sweeper checks, NULL to start over at lastAlloc
+    metadata *sweepBroken;      //block whose overwritten metadata the sweeper reported, the sweeper doesn't walk past it
+    void **cache[M61_NCLASSES]; //free blocks of each size class that only this thread hands out, linked through their second word
+    uint32_t cached[M61_NCLASSES];
+    int growing;                //set while m61_realloc() allocates the block that it moves a block to
+    hitSummary szTracker;
+    hitSummary freqTracker;
+    unsigned long long untilSample; //bytes left until the next sampled allocation (sampling mode only)
+    uint64_t random;            //state of the thread's random number generator for sampling
+    uint32_t id;                //number of the shard in the allocation trace
+    pthread_mutex_t traceLock;  //protects the trace buffer, which is drained by the thread itself or at exit
+    unsigned char *traceBuffer; //events of the allocation trace that weren't written to the trace file yet
+    size_t traceUsed;
+    unsigned long long traceTime;   //time of the last event in the buffer (or of the start of the buffer)
+    unsigned long long traceStart;  //time of the start of the buffer, the timestamp of its chunk
+    int retired;                //set once the thread exited, the state is then taken over by the next new thread
+    struct threadState *next;   //all thread states
+}threadState;
+
+//the functions behind m61_malloc(), m61_free(), m61_memalign() and m61_realloc() at a checking level (M61_LEVEL), picked once at startup
+typedef struct checkLevel {
+    void *(*malloc)(size_t sz, const char *file, int line, uint32_t site, void **frame);
+    void (*free)(void *ptr, size_t sz, const char *file, int line, uint32_t site);  //sz is M61_UNSIZED unless the caller knows it
+    void *(*memalign)(size_t alignment, size_t sz, const char *file, int line, uint32_t site, void **frame);
+    void *(*reallocInPlace)(void *ptr, size_t sz, const char *file, int line, uint32_t site, void **frame);
+}checkLevel;
 
 void m61_getstatistics(struct m61_statistics *stats);
 void m61_printstatistics(void);
+int m61_gethistograms(struct m61_histograms *histograms, const char *file, int line);
+int m61_getpeaks(struct m61_peaks *peaks, const char *file, int line);
 void m61_printleakreport(void);
+void m61_sweep(void);
+void m61_printleaksummary(int mark);
+struct m61_snapshot *m61_snapshot(void);
+int m61_snapshot_diff(const struct m61_snapshot *a, const struct m61_snapshot *b);
+void m61_snapshot_free(struct m61_snapshot *snapshot);
+m61_arena *m61_arena_create(void);
+void *m61_arena_alloc(m61_arena *arena, size_t sz, const char *file, int line);
+void m61_arena_reset(m61_arena *arena, const char *file, int line);
+void m61_arena_destroy(m61_arena *arena, const char *file, int line);
 void printHeavyHitterReport(void);
 
+//internals that libm61.so (m61preload.c) builds on
+span *addressIsInHeap(void *ptr);
+extern int compactDisabled;
+extern FILE *reportFile;
+
 #if !M61_DISABLE
-#define malloc(sz)		m61_malloc((sz), __FILE__, __LINE__)
-#define free(ptr)		m61_free((ptr), __FILE__, __LINE__)
-#define realloc(ptr, sz)	m61_realloc((ptr), (sz), __FILE__, __LINE__)
-#define calloc(nmemb, sz)	m61_calloc((nmemb), (sz), __FILE__, __LINE__)
+#define malloc(sz)		m61_malloc_site((sz), M61_SITE())
+#define free(ptr)		m61_free_site((ptr), M61_SITE())
+#define realloc(ptr, sz)	m61_realloc_site((ptr), (sz), M61_SITE())
+#define calloc(nmemb, sz)	m61_calloc_site((nmemb), (sz), M61_SITE())
+#define memalign(alignment, sz)	m61_memalign_site((alignment), (sz), M61_SITE())
+#define posix_memalign(memptr, alignment, sz)	m61_posix_memalign_site((memptr), (alignment), (sz), M61_SITE())
+#define aligned_alloc(alignment, sz)	m61_aligned_alloc_site((alignment), (sz), M61_SITE())
+#define malloc_usable_size(ptr)	m61_malloc_usable_size((ptr))
+#define free_sized(ptr, sz)	m61_free_sized_site((ptr), (sz), M61_SITE())
 #endif
 
 #endif
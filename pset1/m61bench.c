@@ -0,0 +1,390 @@
+#define M61_DISABLE 1
+#define _GNU_SOURCE
+#include "m61.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+// m61bench: synthetic allocation workloads, timed against m61 and against libc.
+//
+//     m61bench [-n OPS] [-t THREADS] [-s SKEW] [-o RESULTS] [-c BASELINE] [-l LIMIT]
+//
+// Every workload runs with each thread count in THREADS (default 1,2,4) and
+// each allocator, OPS operations per thread (default 200000), in a child
+// process of its own; the best of three runs counts. The results are written
+// to RESULTS as CSV (workload,threads,allocator,ops,ns_per_op,ratio), where
+// ns_per_op is the wall clock time times the number of processors the threads
+// can use, divided by the number of operations, and ratio is m61's time per
+// operation divided by libc's. With -c the ratios are compared with those in
+// BASELINE, and m61bench fails if one of them grew by more than LIMIT times
+// (default 2). Ratios rather than times are compared, so a baseline taken on
+// one machine is still meaningful on another. Every workload also has a
+// ceiling on its ratio that holds with or without a baseline, so a baseline
+// recorded with a pathological path in it can't hide that. m61 runs with the M61_*
+// settings of the environment, so the modes can be benchmarked too.
+//
+// Workloads:
+//   zipf      allocation sizes 16 * rank with rank drawn from a Zipf
+//             distribution over 1..4096 (exponent SKEW, default 1), every block
+//             is freed after an exponentially distributed number of operations
+//             (mean 1000)
+//   prodcons  THREADS producer/consumer pairs: the producer allocates Zipf
+//             sized blocks and hands them to its consumer, which frees them
+//   realloc   growth chains: a block starts at 16 bytes and is reallocated to
+//             1.5 times its size until it passes 64KB, then it is freed
+
+#define MAXTHREADS 64
+#define NRANKS 4096
+#define WHEEL 8192              // lifetimes are cut off at WHEEL - 1 operations
+#define MEANLIFETIME 1000
+#define QUEUESIZE 1024
+
+typedef struct allocator {
+    const char *name;
+    void *(*malloc)(size_t sz, const char *file, int line);
+    void *(*realloc)(void *ptr, size_t sz, const char *file, int line);
+    void (*free)(void *ptr, const char *file, int line);
+} allocator;
+
+void *libcMalloc(size_t sz, const char *file, int line) {
+    (void) file, (void) line;
+    return malloc(sz);
+}
+void *libcRealloc(void *ptr, size_t sz, const char *file, int line) {
+    (void) file, (void) line;
+    return realloc(ptr, sz);
+}
+void libcFree(void *ptr, const char *file, int line) {
+    (void) file, (void) line;
+    free(ptr);
+}
+
+allocator allocators[] = {
+    {"m61", m61_malloc, m61_realloc, m61_free},
+    {"libc", libcMalloc, libcRealloc, libcFree}
+};
+
+allocator *a;
+unsigned long long opsPerThread = 200000;
+double zipfCdf[NRANKS];
+
+// xorshift64*, one generator per thread
+typedef struct prng {
+    uint64_t state;
+} prng;
+
+uint64_t nextRandom(prng *r) {
+    r->state ^= r->state >> 12;
+    r->state ^= r->state << 25;
+    r->state ^= r->state >> 27;
+    return r->state * 0x2545f4914f6cdd1dULL;
+}
+
+// uniform in [0, 1)
+double uniform(prng *r) {
+    return (nextRandom(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+size_t zipfSize(prng *r) {
+    double u = uniform(r);
+    int lo = 0, hi = NRANKS - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (zipfCdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return 16 * (size_t) (lo + 1);
+}
+
+void makeZipf(double skew) {
+    double sum = 0;
+    for (int i = 0; i < NRANKS; ++i)
+        sum += pow(i + 1, -skew);
+    double cdf = 0;
+    for (int i = 0; i < NRANKS; ++i) {
+        cdf += pow(i + 1, -skew) / sum;
+        zipfCdf[i] = cdf;
+    }
+    zipfCdf[NRANKS - 1] = 1;
+}
+
+typedef struct worker {
+    pthread_t thread;
+    int index;
+    prng random;
+    unsigned long long ops;
+    // prodcons: the queue from the producer to its consumer
+    void *queue[QUEUESIZE];
+    unsigned long head, tail;   // written by the consumer and the producer only
+    struct worker *partner;
+} worker;
+
+
+// zipf: blocks are linked into the bucket of the operation that frees them through their first word
+void *zipfWorkload(void *arg) {
+    worker *w = arg;
+    void **wheel = calloc(WHEEL, sizeof(void *));
+    for (unsigned long long t = 0; t < opsPerThread; ) {
+        void **bucket = &wheel[t % WHEEL];
+        while (*bucket && t < opsPerThread) {
+            void *ptr = *bucket;
+            *bucket = *(void **) ptr;
+            a->free(ptr, "m61bench.c", __LINE__);
+            ++t;
+        }
+        if (t == opsPerThread)
+            break;
+        void **ptr = a->malloc(zipfSize(&w->random), "m61bench.c", __LINE__);
+        unsigned long long lifetime = 1 - log(1 - uniform(&w->random)) * MEANLIFETIME;
+        if (lifetime >= WHEEL)
+            lifetime = WHEEL - 1;
+        void **death = &wheel[(t + lifetime) % WHEEL];
+        *ptr = *death;
+        *death = ptr;
+        ++t;
+    }
+    w->ops = opsPerThread;
+    for (int i = 0; i < WHEEL; ++i)
+        while (wheel[i]) {
+            void *ptr = wheel[i];
+            wheel[i] = *(void **) ptr;
+            a->free(ptr, "m61bench.c", __LINE__);
+        }
+    free(wheel);
+    return NULL;
+}
+
+// prodcons: even workers produce, odd workers consume
+void *prodconsWorkload(void *arg) {
+    worker *w = arg;
+    worker *q = w->index % 2 ? w->partner : w;
+    unsigned long long n = opsPerThread / 2;
+    if (w->index % 2 == 0)
+        for (unsigned long long i = 0; i < n; ++i) {
+            void *ptr = a->malloc(zipfSize(&w->random), "m61bench.c", __LINE__);
+            *(char *) ptr = 1;
+            while (__atomic_load_n(&q->tail, __ATOMIC_RELAXED) - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == QUEUESIZE)
+                sched_yield();
+            q->queue[q->tail % QUEUESIZE] = ptr;
+            __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+        }
+    else
+        for (unsigned long long i = 0; i < n; ++i) {
+            while (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == q->head)
+                sched_yield();
+            a->free(q->queue[q->head % QUEUESIZE], "m61bench.c", __LINE__);
+            __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+        }
+    w->ops = n;
+    return NULL;
+}
+
+void *reallocWorkload(void *arg) {
+    worker *w = arg;
+    void *ptr = NULL;
+    size_t sz = 0;
+    for (unsigned long long t = 0; t < opsPerThread; ++t) {
+        if (sz > 65536) {
+            a->free(ptr, "m61bench.c", __LINE__);
+            ptr = NULL;
+            sz = 0;
+        } else {
+            sz = sz ? sz + sz / 2 : 16;
+            ptr = a->realloc(ptr, sz, "m61bench.c", __LINE__);
+            ((char *) ptr)[sz - 1] = 1;
+        }
+    }
+    a->free(ptr, "m61bench.c", __LINE__);
+    w->ops = opsPerThread;
+    return NULL;
+}
+
+typedef struct workload {
+    const char *name;
+    void *(*run)(void *);
+    int threadsPerUnit;         // prodcons runs a producer and a consumer per thread count
+    double ceiling;             // highest m61/libc ratio that passes, whatever the baseline says
+} workload;
+
+workload workloads[] = {
+    {"zipf", zipfWorkload, 1, 2},
+    {"prodcons", prodconsWorkload, 2, 2},
+    {"realloc", reallocWorkload, 1, 14}
+};
+
+// runs a workload with nthreads threads in a child process and returns the time per operation in ns
+double measure(workload *wl, allocator *al, int nthreads) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        a = al;
+        int n = nthreads * wl->threadsPerUnit;
+        worker *workers = calloc(n, sizeof(worker));
+        for (int i = 0; i < n; ++i) {
+            workers[i].index = i;
+            workers[i].random.state = 0x9e3779b97f4a7c15ULL * (i + 1);
+            workers[i].partner = &workers[i ^ 1];
+        }
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < n; ++i)
+            pthread_create(&workers[i].thread, NULL, wl->run, &workers[i]);
+        unsigned long long ops = 0;
+        for (int i = 0; i < n; ++i) {
+            pthread_join(workers[i].thread, NULL);
+            ops += workers[i].ops;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        // the time a processor spends per operation
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) * (n < cpus ? n : cpus) / ops;
+        if (write(fds[1], &ns, sizeof(ns)) != sizeof(ns))
+            _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+    double ns = -1;
+    if (read(fds[0], &ns, sizeof(ns)) != sizeof(ns))
+        ns = -1;
+    close(fds[0]);
+    int status;
+    waitpid(child, &status, 0);
+    if (ns < 0) {
+        fprintf(stderr, "m61bench: %s with %d threads failed on %s\n", wl->name, nthreads, al->name);
+        exit(1);
+    }
+    return ns;
+}
+
+typedef struct result {
+    char workload[32];
+    int threads;
+    double m61, libc, ratio;
+} result;
+
+// reads the m61 rows of a results file, returns the number of results
+int readResults(const char *path, result *results, int capacity) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    char line[256], name[32], al[32];
+    int n = 0, threads;
+    unsigned long long ops;
+    double ns, ratio;
+    while (n < capacity && fgets(line, sizeof(line), f))
+        if (sscanf(line, "%31[^,],%d,%31[^,],%llu,%lf,%lf", name, &threads, al, &ops, &ns, &ratio) == 6
+            && strcmp(al, "m61") == 0) {
+            strcpy(results[n].workload, name);
+            results[n].threads = threads;
+            results[n].ratio = ratio;
+            ++n;
+        }
+    fclose(f);
+    return n;
+}
+
+int main(int argc, char **argv) {
+    const char *threadList = "1,2,4", *output = NULL, *baseline = NULL;
+    double skew = 1, limit = 2;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:s:o:c:l:")) != -1)
+        switch (opt) {
+        case 'n':
+            opsPerThread = strtoull(optarg, 0, 0);
+            break;
+        case 't':
+            threadList = optarg;
+            break;
+        case 's':
+            skew = strtod(optarg, 0);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'c':
+            baseline = optarg;
+            break;
+        case 'l':
+            limit = strtod(optarg, 0);
+            break;
+        default:
+            fprintf(stderr, "Usage: m61bench [-n OPS] [-t THREADS] [-s SKEW] [-o RESULTS] [-c BASELINE] [-l LIMIT]\n");
+            return 1;
+        }
+    if (opsPerThread < 2)
+        opsPerThread = 2;
+    makeZipf(skew);
+    int threads[MAXTHREADS], nthreadCounts = 0;
+    for (const char *s = threadList; *s && nthreadCounts < MAXTHREADS; s += strcspn(s, ","), s += *s == ',') {
+        int t = atoi(s);
+        if (t > 0 && t * 2 <= MAXTHREADS)
+            threads[nthreadCounts++] = t;
+    }
+
+    result results[64];
+    int nresults = 0, regressions = 0;
+    FILE *out = output ? fopen(output, "w") : NULL;
+    if (output && !out) {
+        perror(output);
+        return 1;
+    }
+    if (out)
+        fprintf(out, "workload,threads,allocator,ops,ns_per_op,ratio\n");
+    printf("%-10s %7s %12s %12s %8s\n", "workload", "threads", "m61 ns/op", "libc ns/op", "ratio");
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w)
+        for (int i = 0; i < nthreadCounts && nresults < 64; ++i) {
+            result *r = &results[nresults++];
+            snprintf(r->workload, sizeof(r->workload), "%s", workloads[w].name);
+            r->threads = threads[i];
+            r->m61 = r->libc = INFINITY;
+            for (int run = 0; run < 3; ++run) {
+                r->m61 = fmin(r->m61, measure(&workloads[w], &allocators[0], threads[i]));
+                r->libc = fmin(r->libc, measure(&workloads[w], &allocators[1], threads[i]));
+            }
+            r->ratio = r->m61 / r->libc;
+            printf("%-10s %7d %12.1f %12.1f %8.2f\n", r->workload, r->threads, r->m61, r->libc, r->ratio);
+            if (out) {
+                fprintf(out, "%s,%d,m61,%llu,%.1f,%.3f\n", r->workload, r->threads, opsPerThread, r->m61, r->ratio);
+                fprintf(out, "%s,%d,libc,%llu,%.1f,%.3f\n", r->workload, r->threads, opsPerThread, r->libc, 1.0);
+            }
+        }
+    if (out)
+        fclose(out);
+
+    for (int i = 0; i < nresults; ++i)
+        for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w)
+            if (strcmp(results[i].workload, workloads[w].name) == 0 && results[i].ratio > workloads[w].ceiling) {
+                printf("REGRESSION: %s with %d threads: m61/libc %.2f, ceiling %.0f\n",
+                       results[i].workload, results[i].threads, results[i].ratio, workloads[w].ceiling);
+                ++regressions;
+            }
+    if (!baseline)
+        return regressions ? 1 : 0;
+    result base[64];
+    int nbase = readResults(baseline, base, 64);
+    for (int i = 0; i < nresults; ++i)
+        for (int j = 0; j < nbase; ++j)
+            if (strcmp(results[i].workload, base[j].workload) == 0 && results[i].threads == base[j].threads
+                && results[i].ratio > base[j].ratio * limit) {
+                printf("REGRESSION: %s with %d threads: m61/libc %.2f, baseline %.2f\n",
+                       results[i].workload, results[i].threads, results[i].ratio, base[j].ratio);
+                ++regressions;
+            }
+    if (regressions)
+        return 1;
+    printf("*** No regressions against %s.\n", baseline);
+    return 0;
+}
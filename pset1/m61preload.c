@@ -0,0 +1,373 @@
+#define M61_DISABLE 1
+#define _GNU_SOURCE
+#include "m61.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <dlfcn.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+// libm61.so: m61 for programs that weren't built with m61.h
+//     LD_PRELOAD=./libm61.so program
+// malloc(), free(), realloc(), calloc(), the memalign family, free_sized() and malloc_usable_size() are served by m61,
+// the call site of an allocation is the return address of the call. At exit the statistics, the leak report and the heavy
+// hitter report are printed to stderr (M61_REPORT picks some of them: s, l and h), M61_REPORT_SIGNAL=<signal number> prints
+// them whenever the signal arrives.
+
+#define M61_EXPORT __attribute__((visibility("default")))
+
+#define PRELOAD_BOOTSTRAP ((size_t)4<<20)  //size of the arena for allocations that are made from inside m61
+#define PRELOAD_MAXSITES ((size_t)1<<20)   //the table of return addresses is reserved for this many sites up front
+#define PRELOAD_SITENAME 112
+#define PRELOAD_ALIGN 16                   //alignment of every m61 payload outside compact mode
+
+//the name of the call site at a return address and the id m61 interned it to
+typedef struct addressSite {
+    void *address;
+    int ready;              //set once the name and the id are written
+    uint32_t id;
+    char name[PRELOAD_SITENAME];
+}addressSite;
+
+//set while the thread is inside m61: a malloc() made by m61 itself (printf() allocating its buffer while a report holds a lock,
+//pthread_atfork() during the initialization, ...) must not reenter m61, it is served from the bootstrap arena instead
+__thread int preloadBusy __attribute__((tls_model("initial-exec")));
+char bootstrapArena[PRELOAD_BOOTSTRAP] __attribute__((aligned(PRELOAD_ALIGN)));
+size_t bootstrapUsed;
+addressSite *addressSites;    //open addressing hash table of return addresses, never resized
+uint32_t unknownSite;         //id of the name "?", for the sites that don't fit into the table
+int reportPipe[2];            //the signal handler wakes up the report thread through this pipe
+
+void *bootstrapMalloc(size_t sz);
+int isBootstrap(void *ptr);
+uint32_t siteId(void *address);
+void nameSite(addressSite *site, void *address);
+void *libcSymbol(void **cache, const char *name);
+size_t usableSize(void *ptr);
+void *preloadMalloc(size_t sz, void *address);
+int preloadMemalign(void **memptr, size_t alignment, size_t sz, void *address);
+void printReports(void);
+void reportSignal(int signo);
+void *reportThread(void *arg);
+void preloadInit(void) __attribute__((constructor));
+void preloadExit(void) __attribute__((destructor));
+
+//returns zeroed memory that is never given back, the size is stored in front of the payload for realloc()
+void *bootstrapMalloc(size_t sz){
+    if(sz>PRELOAD_BOOTSTRAP)
+        return NULL;
+    size_t len=PRELOAD_ALIGN+((sz+PRELOAD_ALIGN-1)&~(size_t)(PRELOAD_ALIGN-1));
+    size_t offset=__atomic_fetch_add(&bootstrapUsed,len,__ATOMIC_RELAXED);
+    if(offset+len>PRELOAD_BOOTSTRAP)
+        return NULL;
+    memcpy(bootstrapArena+offset,&sz,sizeof(sz));
+    return bootstrapArena+offset+PRELOAD_ALIGN;
+}
+
+int isBootstrap(void *ptr){
+    return (char *)ptr>=bootstrapArena&&(char *)ptr<bootstrapArena+PRELOAD_BOOTSTRAP;
+}
+
+//returns the id of the call site at a return address, called with preloadBusy set
+//entries are claimed with a compare and swap on the address and never move, so lookups don't take a lock
+uint32_t siteId(void *address){
+    addressSite *sites=__atomic_load_n(&addressSites,__ATOMIC_ACQUIRE);
+    if(!sites){
+        sites=mmap(NULL,PRELOAD_MAXSITES*sizeof(addressSite),PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+        if(sites==MAP_FAILED)
+            return unknownSite?unknownSite:m61_intern_site(&unknownSite,"?",0);
+        addressSite *expected=NULL;
+        if(!__atomic_compare_exchange_n(&addressSites,&expected,sites,0,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)){
+            munmap(sites,PRELOAD_MAXSITES*sizeof(addressSite));
+            sites=expected;
+        }
+    }
+    size_t mask=PRELOAD_MAXSITES-1;
+    size_t h=(size_t)(((uintptr_t)address>>2)*0x9e3779b97f4a7c15ULL>>32)&mask;
+    //a table that is half full is as good as full, the remaining sites share the name "?"
+    for(size_t probes=0;probes<PRELOAD_MAXSITES/2;++probes,h=(h+1)&mask){
+        addressSite *site=&sites[h];
+        void *found=__atomic_load_n(&site->address,__ATOMIC_ACQUIRE);
+        if(!found){
+            if(__atomic_compare_exchange_n(&site->address,&found,address,0,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)){
+                nameSite(site,address);
+                m61_intern_site(&site->id,site->name,0);
+                __atomic_store_n(&site->ready,1,__ATOMIC_RELEASE);
+                return site->id;
+            }
+        }
+        if(found==address){
+            while(!__atomic_load_n(&site->ready,__ATOMIC_ACQUIRE))
+                sched_yield();
+            return site->id;
+        }
+    }
+    return unknownSite?unknownSite:m61_intern_site(&unknownSite,"?",0);
+}
+
+//names a site like backtrace_symbols() does: module(symbol+offset), or module(+offset) for code without a dynamic symbol
+//dladdr() is called without any lock of m61 held, so a thread that allocates inside dlopen() can't deadlock with it
+void nameSite(addressSite *site, void *address){
+    Dl_info info;
+    if(dladdr(address,&info)&&info.dli_sname)
+        snprintf(site->name,PRELOAD_SITENAME,"%s(%s+0x%tx)",info.dli_fname,info.dli_sname,(char *)address-(char *)info.dli_saddr);
+    else if(dladdr(address,&info))
+        snprintf(site->name,PRELOAD_SITENAME,"%s(+0x%tx)",info.dli_fname,(char *)address-(char *)info.dli_fbase);
+    else
+        snprintf(site->name,PRELOAD_SITENAME,"%p",address);
+}
+
+//looks up the libc version of an allocation function, dlsym() may allocate itself
+void *libcSymbol(void **cache, const char *name){
+    void *fn=__atomic_load_n(cache,__ATOMIC_ACQUIRE);
+    if(!fn){
+        int busy=preloadBusy;
+        preloadBusy=1;
+        fn=dlsym(RTLD_NEXT,name);
+        preloadBusy=busy;
+        __atomic_store_n(cache,fn,__ATOMIC_RELEASE);
+    }
+    return fn;
+}
+
+void *libcFree;
+void *libcRealloc;
+void *libcUsableSize;
+
+//returns the size of the payload ptr, which may come from m61, the bootstrap arena or libc
+size_t usableSize(void *ptr){
+    if(isBootstrap(ptr)){
+        size_t sz;
+        memcpy(&sz,(char *)ptr-PRELOAD_ALIGN,sizeof(sz));
+        return sz;
+    }
+    if(addressIsInHeap(ptr))
+        return m61_malloc_usable_size(ptr);
+    size_t (*fn)(void *)=libcSymbol(&libcUsableSize,"malloc_usable_size");
+    return fn?fn(ptr):0;
+}
+
+void *preloadMalloc(size_t sz, void *address){
+    if(preloadBusy)
+        return bootstrapMalloc(sz);
+    preloadBusy=1;
+    void *ptr=m61_malloc_site(sz,siteId(address));
+    preloadBusy=0;
+    if(!ptr)
+        errno=ENOMEM;
+    return ptr;
+}
+
+//alignments up to 16 bytes are what every payload gets, including those of the bootstrap arena
+int preloadMemalign(void **memptr, size_t alignment, size_t sz, void *address){
+    if(!alignment||alignment&(alignment-1)||alignment%sizeof(void *))
+        return EINVAL;
+    if(alignment<=PRELOAD_ALIGN){
+        void *ptr=preloadMalloc(sz,address);
+        if(!ptr)
+            return ENOMEM;
+        *memptr=ptr;
+        return 0;
+    }
+    //inside m61 the payload is aligned within a bigger bootstrap block, the size goes in front of the aligned payload
+    if(preloadBusy){
+        char *ptr=sz<=PRELOAD_BOOTSTRAP?bootstrapMalloc(sz+alignment):NULL;
+        if(!ptr)
+            return ENOMEM;
+        char *aligned=(char *)(((uintptr_t)ptr+alignment-1)&~(uintptr_t)(alignment-1));
+        memcpy(aligned-PRELOAD_ALIGN,&sz,sizeof(sz));
+        *memptr=aligned;
+        return 0;
+    }
+    preloadBusy=1;
+    int error=m61_posix_memalign_site(memptr,alignment,sz,siteId(address));
+    preloadBusy=0;
+    return error;
+}
+
+M61_EXPORT void *malloc(size_t sz){
+    return preloadMalloc(sz,__builtin_return_address(0));
+}
+
+M61_EXPORT void free(void *ptr){
+    if(!ptr||isBootstrap(ptr))
+        return;
+    if(!addressIsInHeap(ptr)){
+        void (*fn)(void *)=libcSymbol(&libcFree,"free");
+        if(fn)
+            fn(ptr);
+        return;
+    }
+    //a block that is freed from inside m61 stays allocated rather than reentering m61
+    if(preloadBusy)
+        return;
+    preloadBusy=1;
+    m61_free_site(ptr,siteId(__builtin_return_address(0)));
+    preloadBusy=0;
+}
+
+M61_EXPORT void *calloc(size_t nmemb, size_t sz){
+    if(preloadBusy)
+        return nmemb&&sz>(size_t)-1/nmemb?NULL:bootstrapMalloc(nmemb*sz);
+    preloadBusy=1;
+    void *ptr=m61_calloc_site(nmemb,sz,siteId(__builtin_return_address(0)));
+    preloadBusy=0;
+    if(!ptr)
+        errno=ENOMEM;
+    return ptr;
+}
+
+M61_EXPORT void *realloc(void *ptr, size_t sz){
+    void *address=__builtin_return_address(0);
+    if(!ptr)
+        return preloadMalloc(sz,address);
+    if(!isBootstrap(ptr)&&!addressIsInHeap(ptr)){
+        void *(*fn)(void *, size_t)=libcSymbol(&libcRealloc,"realloc");
+        return fn?fn(ptr,sz):NULL;
+    }
+    //bootstrap blocks, and m61 blocks inside m61, are copied into a new block and left where they are
+    if(preloadBusy||isBootstrap(ptr)){
+        if(!sz)
+            return NULL;
+        void *newPtr=preloadMalloc(sz,address);
+        if(newPtr){
+            size_t oldSz=usableSize(ptr);
+            memcpy(newPtr,ptr,oldSz<sz?oldSz:sz);
+        }
+        return newPtr;
+    }
+    preloadBusy=1;
+    void *newPtr=m61_realloc_site(ptr,sz,siteId(address));
+    preloadBusy=0;
+    if(!newPtr&&sz)
+        errno=ENOMEM;
+    return newPtr;
+}
+
+M61_EXPORT int posix_memalign(void **memptr, size_t alignment, size_t sz){
+    return preloadMemalign(memptr,alignment,sz,__builtin_return_address(0));
+}
+
+M61_EXPORT void *aligned_alloc(size_t alignment, size_t sz){
+    void *ptr=NULL;
+    int error=preloadMemalign(&ptr,alignment<sizeof(void *)?sizeof(void *):alignment,sz,__builtin_return_address(0));
+    if(error)
+        errno=error;
+    return ptr;
+}
+
+M61_EXPORT void *memalign(size_t alignment, size_t sz){
+    void *ptr=NULL;
+    int error=preloadMemalign(&ptr,alignment<sizeof(void *)?sizeof(void *):alignment,sz,__builtin_return_address(0));
+    if(error)
+        errno=error;
+    return ptr;
+}
+
+M61_EXPORT void *valloc(size_t sz){
+    void *ptr=NULL;
+    int error=preloadMemalign(&ptr,(size_t)sysconf(_SC_PAGESIZE),sz,__builtin_return_address(0));
+    if(error)
+        errno=error;
+    return ptr;
+}
+
+M61_EXPORT void *pvalloc(size_t sz){
+    size_t page=(size_t)sysconf(_SC_PAGESIZE);
+    void *ptr=NULL;
+    int error=sz>(size_t)-1-page?ENOMEM:preloadMemalign(&ptr,page,(sz+page-1)&~(page-1),__builtin_return_address(0));
+    if(error)
+        errno=error;
+    return ptr;
+}
+
+M61_EXPORT void free_sized(void *ptr, size_t sz){
+    if(!ptr||isBootstrap(ptr)||preloadBusy||!addressIsInHeap(ptr)){
+        free(ptr);
+        return;
+    }
+    preloadBusy=1;
+    m61_free_sized_site(ptr,sz,siteId(__builtin_return_address(0)));
+    preloadBusy=0;
+}
+
+M61_EXPORT void free_aligned_sized(void *ptr, size_t alignment, size_t sz){
+    (void) alignment;
+    free_sized(ptr,sz);
+}
+
+M61_EXPORT size_t malloc_usable_size(void *ptr){
+    return ptr?usableSize(ptr):0;
+}
+
+//prints the reports that M61_REPORT asks for (s statistics, l leaks, h heavy hitters, all of them by default)
+//printf() may allocate its buffer while a report holds a lock of m61, so the reports run with preloadBusy set
+void printReports(void){
+    const char *which=getenv("M61_REPORT");
+    if(!which)
+        which="slh";
+    preloadBusy=1;
+    if(strchr(which,'s'))
+        m61_printstatistics();
+    if(strchr(which,'l'))
+        m61_printleakreport();
+    if(strchr(which,'h'))
+        printHeavyHitterReport();
+    fflush(reportFile);
+    preloadBusy=0;
+}
+
+//the handler can't print the reports itself, the signal may have interrupted m61 with a lock held
+void reportSignal(int signo){
+    (void) signo;
+    int saved=errno;
+    if(write(reportPipe[1],"r",1)){}
+    errno=saved;
+}
+
+void *reportThread(void *arg){
+    (void) arg;
+    char c;
+    for(;;){
+        ssize_t n=read(reportPipe[0],&c,1);
+        if(n==1)
+            printReports();
+        else if(n==0||errno!=EINTR)
+            return NULL;
+    }
+}
+
+//the reports go to a stream of their own on a copy of stderr, programs close stdout and stderr in atexit() handlers before they are printed
+void preloadInit(void){
+    compactDisabled=1;
+    int fd=fcntl(2,F_DUPFD_CLOEXEC,3);
+    if(fd>=0){
+        preloadBusy=1;
+        reportFile=fdopen(fd,"w");
+        if(reportFile)
+            setvbuf(reportFile,NULL,_IOLBF,BUFSIZ);
+        else
+            close(fd);
+        preloadBusy=0;
+    }
+    const char *env=getenv("M61_REPORT_SIGNAL");
+    if(!env||atoi(env)<=0||pipe(reportPipe))
+        return;
+    pthread_t thread;
+    if(pthread_create(&thread,NULL,reportThread,NULL))
+        return;
+    pthread_detach(thread);
+    struct sigaction action;
+    memset(&action,0,sizeof(action));
+    action.sa_handler=reportSignal;
+    action.sa_flags=SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(atoi(env),&action,NULL);
+}
+
+void preloadExit(void){
+    printReports();
+}
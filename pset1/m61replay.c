@@ -0,0 +1,511 @@
+#define M61_DISABLE 1
+#define _GNU_SOURCE
+#include "m61.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+// m61replay: replays an allocation trace against m61 and against libc.
+//
+// The trace is a text file with one call per line:
+//     OP SIZE ID SITE
+// OP is m (malloc), c (calloc), r (realloc) or f (free). SIZE is the number of
+// bytes requested (calloc: nmemb * size, free: ignored). ID names the object:
+// malloc and calloc create object ID, realloc resizes it (or creates it if it
+// doesn't exist), free destroys it. SITE is file:line and is passed to m61.
+// Lines starting with # are comments.
+//
+//     m61replay [-n REPEAT] TRACE      replay TRACE and report ns/op, peak RSS and fragmentation
+//     m61replay -l LTRACELOG           convert the output of `ltrace -e malloc+free+realloc+calloc` to a trace
+//     m61replay -b M61TRACE            convert a binary trace written by M61_TRACE to a trace
+//
+// replay/ has a small sample of each format; `make check-replay` runs
+// m61replay on them and compares the output with replay/*.expected.
+
+typedef struct call {
+    char op;
+    size_t size;
+    size_t id;
+    const char *file;   // interned, one copy of each name; m61 interns (file, line) into a site id on the first call
+    int line;
+} call;
+
+call *calls;
+size_t ncalls, capacity;
+size_t maxid;
+
+// the distinct file names of the trace's sites
+char **files;
+size_t nfiles;
+
+const char *internFile(const char *file, size_t len) {
+    for (size_t i = 0; i < nfiles; ++i)
+        if (strlen(files[i]) == len && memcmp(files[i], file, len) == 0)
+            return files[i];
+    files = realloc(files, (nfiles + 1) * sizeof(char *));
+    files[nfiles] = strndup(file, len);
+    return files[nfiles++];
+}
+
+void addCall(char op, size_t size, size_t id, const char *site) {
+    if (ncalls == capacity) {
+        capacity = capacity ? capacity * 2 : 4096;
+        calls = realloc(calls, capacity * sizeof(call));
+    }
+    const char *colon = strrchr(site, ':');
+    size_t len = colon ? (size_t) (colon - site) : strlen(site);
+    calls[ncalls].op = op;
+    calls[ncalls].size = size;
+    calls[ncalls].id = id;
+    calls[ncalls].file = internFile(site, len);
+    calls[ncalls].line = colon ? atoi(colon + 1) : 0;
+    if (id > maxid)
+        maxid = id;
+    ++ncalls;
+}
+
+int readTrace(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return 0;
+    }
+    char line[4096], site[4096];
+    char op;
+    size_t size, id;
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        ++lineno;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, " %c %zu %zu %4095s", &op, &size, &id, site) != 4 || !strchr("mcrf", op)) {
+            fprintf(stderr, "%s:%d: malformed call\n", path, lineno);
+            fclose(f);
+            return 0;
+        }
+        addCall(op, size, id, site);
+    }
+    fclose(f);
+    return 1;
+}
+
+
+// Conversion of ltrace logs. Lines look like
+//     [pid 42] [0x4005d3] prog->malloc(100)                 = 0x1d2e010
+//     prog->realloc(0x1d2e010, 200)                         = 0x1d2e440
+// The instruction pointer (ltrace -i) becomes the site if it is there.
+// Calls that were interrupted (<unfinished ...>) are skipped.
+
+// maps the addresses of live objects to their ids
+typedef struct object {
+    uint64_t address;
+    size_t id;
+} object;
+
+object *objects;
+size_t objectsCapacity;     // power of two, open addressing with tombstones (id 0)
+size_t nobjects;
+size_t nextid = 1;
+
+object *findObject(uint64_t address, int insert) {
+    if (insert && (nobjects + 1) * 2 > objectsCapacity) {
+        object *old = objects;
+        size_t oldCapacity = objectsCapacity;
+        objectsCapacity = objectsCapacity ? objectsCapacity * 2 : 1024;
+        objects = calloc(objectsCapacity, sizeof(object));
+        nobjects = 0;
+        for (size_t i = 0; i < oldCapacity; ++i)
+            if (old[i].id) {
+                *findObject(old[i].address, 1) = old[i];
+                ++nobjects;
+            }
+        free(old);
+    }
+    if (!objectsCapacity)
+        return NULL;
+    object *tombstone = NULL;
+    for (size_t h = (address >> 3) * 0x9e3779b97f4a7c15ULL & (objectsCapacity - 1); ; h = (h + 1) & (objectsCapacity - 1)) {
+        object *o = &objects[h];
+        if (o->id && o->address == address)
+            return o;
+        if (!o->id && o->address == 1 && !tombstone)
+            tombstone = o;
+        if (!o->id && o->address != 1)
+            return insert ? (tombstone ? tombstone : o) : NULL;
+    }
+}
+
+// records that object id lives at address and returns id
+size_t setObject(uint64_t address, size_t id) {
+    object *o = findObject(address, 1);
+    if (!o->id)
+        ++nobjects;
+    o->address = address;
+    o->id = id;
+    return id;
+}
+
+// returns the id of a new object at address
+size_t newObject(uint64_t address) {
+    return setObject(address, nextid++);
+}
+
+// returns the id of the object at address and forgets it, 0 if there is none
+size_t takeObject(uint64_t address) {
+    object *o = findObject(address, 0);
+    if (!o)
+        return 0;
+    size_t id = o->id;
+    o->id = 0;
+    o->address = 1;
+    return id;
+}
+
+int convertLtrace(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return 0;
+    }
+    char line[4096];
+    size_t skipped = 0;
+    printf("# converted from the ltrace log %s\n", path);
+    while (fgets(line, sizeof(line), f)) {
+        char site[64] = "ltrace:0";
+        char *ip = strstr(line, "[0x");
+        if (ip)
+            snprintf(site, sizeof(site), "%.*s:0", (int) strcspn(ip + 1, "]"), ip + 1);
+        char *call = NULL;
+        const char *names[] = {"malloc(", "calloc(", "realloc(", "free("};
+        int which;
+        for (which = 0; which < 4 && !call; ++which) {
+            char *name = strstr(line, names[which]);
+            // the function name must not be the end of a longer name
+            if (name && (name == line || !(name[-1] == '_' || (name[-1] >= 'a' && name[-1] <= 'z'))))
+                call = name + strlen(names[which]);
+        }
+        char *result = call ? strrchr(call, '=') : NULL;
+        if (!call || strstr(line, "<unfinished") || strstr(line, "resumed>") || !result) {
+            skipped += call != NULL;
+            continue;
+        }
+        unsigned long long a = 0, b = 0, ret = strtoull(result + 1, NULL, 16);
+        sscanf(call, "%lli, %lli", &a, &b);
+        switch (which - 1) {
+        case 0:
+            if (ret)
+                printf("m %llu %zu %s\n", a, newObject(ret), site);
+            break;
+        case 1:
+            if (ret)
+                printf("c %llu %zu %s\n", a * b, newObject(ret), site);
+            break;
+        case 2: {
+            size_t id = a ? takeObject(a) : 0;
+            if (!ret) {
+                // a failed realloc leaves the object alone, realloc(ptr, 0) frees it
+                if (id && b)
+                    setObject(a, id);
+                else if (id)
+                    printf("f 0 %zu %s\n", id, site);
+                break;
+            }
+            printf("r %llu %zu %s\n", b, setObject(ret, id ? id : nextid++), site);
+            break;
+        }
+        case 3: {
+            size_t id = a ? takeObject(a) : 0;
+            if (id)
+                printf("f 0 %zu %s\n", id, site);
+            break;
+        }
+        }
+    }
+    fclose(f);
+    if (skipped)
+        fprintf(stderr, "%s: skipped %zu interrupted calls\n", path, skipped);
+    return 1;
+}
+
+
+// Conversion of binary traces (see M61_TRACE in m61.h). Events of different
+// threads are put in order by their timestamps.
+
+typedef struct event {
+    unsigned long long time;
+    int op;
+    size_t index;
+    uint64_t site, size, token, newToken;
+} event;
+
+event *events;
+size_t nevents, eventsCapacity;
+char **sites;           // "file:line" by site id
+size_t sitesCapacity;
+
+uint64_t getVarint(unsigned char **p, unsigned char *end) {
+    uint64_t value = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char byte = *(*p)++;
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    return value;
+}
+
+int compareEvents(const void *a, const void *b) {
+    const event *x = a, *y = b;
+    if (x->time != y->time)
+        return (x->time > y->time) - (x->time < y->time);
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+const char *siteName(uint64_t id) {
+    return id < sitesCapacity && sites[id] ? sites[id] : "?:0";
+}
+
+int convertBinary(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *trace = malloc(length > 0 ? length : 1);
+    if (length < 16 || fread(trace, 1, length, f) != (size_t) length || memcmp(trace, "M61TRACE", 8) != 0) {
+        fprintf(stderr, "%s: not an m61 trace\n", path);
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+    uint32_t header;
+    memcpy(&header, trace + 12, 4);
+    for (unsigned char *p = trace + header; p + 16 <= trace + length; ) {
+        uint32_t len;
+        unsigned long long time;
+        memcpy(&len, p, 4);
+        memcpy(&time, p + 8, 8);
+        unsigned char *end = p + 16 + len;
+        if (end > trace + length)
+            break;
+        for (p += 16; p < end; ) {
+            int op = *p++;
+            if (op == M61_TRACE_SITE) {
+                uint64_t id = getVarint(&p, end), line = getVarint(&p, end), namelen = getVarint(&p, end);
+                if (id >= sitesCapacity) {
+                    size_t grown = sitesCapacity ? sitesCapacity : 1024;
+                    while (grown <= id)
+                        grown *= 2;
+                    sites = realloc(sites, grown * sizeof(char *));
+                    memset(sites + sitesCapacity, 0, (grown - sitesCapacity) * sizeof(char *));
+                    sitesCapacity = grown;
+                }
+                if (asprintf(&sites[id], "%.*s:%llu", (int) namelen, (char *) p, (unsigned long long) line) < 0)
+                    sites[id] = NULL;
+                p += namelen;
+                continue;
+            }
+            if (nevents == eventsCapacity) {
+                eventsCapacity = eventsCapacity ? eventsCapacity * 2 : 4096;
+                events = realloc(events, eventsCapacity * sizeof(event));
+            }
+            event *e = &events[nevents++];
+            e->op = op;
+            time += getVarint(&p, end);
+            e->time = time;
+            e->site = getVarint(&p, end);
+            e->size = op == M61_TRACE_FREE ? 0 : getVarint(&p, end);
+            e->token = getVarint(&p, end);
+            e->newToken = op == M61_TRACE_REALLOC ? getVarint(&p, end) : 0;
+        }
+    }
+    free(trace);
+    // qsort isn't stable and the events of one thread can have the same time, so the position in the file breaks ties
+    for (size_t i = 0; i < nevents; ++i)
+        events[i].index = i;
+    qsort(events, nevents, sizeof(event), compareEvents);
+    printf("# converted from the m61 trace %s\n", path);
+    for (size_t i = 0; i < nevents; ++i) {
+        event *e = &events[i];
+        const char *site = siteName(e->site);
+        if (e->op == M61_TRACE_MALLOC && e->token)
+            printf("m %llu %zu %s\n", (unsigned long long) e->size, newObject(e->token), site);
+        else if (e->op == M61_TRACE_CALLOC && e->token)
+            printf("c %llu %zu %s\n", (unsigned long long) e->size, newObject(e->token), site);
+        else if (e->op == M61_TRACE_FREE && e->token) {
+            size_t id = takeObject(e->token);
+            if (id)
+                printf("f 0 %zu %s\n", id, site);
+        } else if (e->op == M61_TRACE_REALLOC) {
+            size_t id = e->token ? takeObject(e->token) : 0;
+            if (!e->newToken) {
+                if (id && e->size)
+                    setObject(e->token, id);
+                else if (id)
+                    printf("f 0 %zu %s\n", id, site);
+                continue;
+            }
+            printf("r %llu %zu %s\n", (unsigned long long) e->size, setObject(e->newToken, id ? id : nextid++), site);
+        }
+    }
+    return 1;
+}
+
+
+// Replay
+
+typedef struct allocator {
+    const char *name;
+    void *(*malloc)(size_t sz, const char *file, int line);
+    void *(*calloc)(size_t nmemb, size_t sz, const char *file, int line);
+    void *(*realloc)(void *ptr, size_t sz, const char *file, int line);
+    void (*free)(void *ptr, const char *file, int line);
+} allocator;
+
+void *libcMalloc(size_t sz, const char *file, int line) {
+    (void) file, (void) line;
+    return malloc(sz);
+}
+void *libcCalloc(size_t nmemb, size_t sz, const char *file, int line) {
+    (void) file, (void) line;
+    return calloc(nmemb, sz);
+}
+void *libcRealloc(void *ptr, size_t sz, const char *file, int line) {
+    (void) file, (void) line;
+    return realloc(ptr, sz);
+}
+void libcFree(void *ptr, const char *file, int line) {
+    (void) file, (void) line;
+    free(ptr);
+}
+
+allocator allocators[] = {
+    {"m61", m61_malloc, m61_calloc, m61_realloc, m61_free},
+    {"libc", libcMalloc, libcCalloc, libcRealloc, libcFree}
+};
+
+// writes one byte of every page of a new block, so that the block counts towards the resident set like a block in use
+void touch(char *ptr, size_t size) {
+    for (size_t i = 0; i < size; i += 4096)
+        ptr[i] = 1;
+}
+
+// replays the trace in a child process, so that every allocator starts with a fresh heap and its own peak RSS
+void replay(allocator *a, int repeat) {
+    pid_t child = fork();
+    if (child != 0) {
+        waitpid(child, NULL, 0);
+        return;
+    }
+    void **live = calloc(maxid + 1, sizeof(void *));
+    size_t *sizes = calloc(maxid + 1, sizeof(size_t));
+    // the replay's own tables must be resident before the baseline is taken
+    memset(live, 0, (maxid + 1) * sizeof(void *));
+    memset(sizes, 0, (maxid + 1) * sizeof(size_t));
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long baseline = usage.ru_maxrss;
+    size_t liveBytes = 0, peakBytes = 0, failed = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < repeat; ++round) {
+        for (size_t i = 0; i < ncalls; ++i) {
+            call *c = &calls[i];
+            void **slot = &live[c->id];
+            switch (c->op) {
+            case 'm':
+            case 'c':
+                if (*slot) {
+                    a->free(*slot, c->file, c->line);
+                    liveBytes -= sizes[c->id];
+                }
+                *slot = c->op == 'm' ? a->malloc(c->size, c->file, c->line) : a->calloc(1, c->size, c->file, c->line);
+                break;
+            case 'r': {
+                void *ptr = a->realloc(*slot, c->size, c->file, c->line);
+                if (!ptr && c->size) {
+                    ++failed;
+                    continue;
+                }
+                liveBytes -= *slot ? sizes[c->id] : 0;
+                *slot = ptr;
+                break;
+            }
+            case 'f':
+                if (*slot) {
+                    a->free(*slot, c->file, c->line);
+                    liveBytes -= sizes[c->id];
+                    *slot = NULL;
+                }
+                continue;
+            }
+            if (*slot) {
+                sizes[c->id] = c->size;
+                liveBytes += c->size;
+                touch(*slot, c->size);
+                if (liveBytes > peakBytes)
+                    peakBytes = liveBytes;
+            } else if (c->size)
+                ++failed;
+        }
+        // objects that are still live at the end are freed, so that the next round starts from the same state
+        for (size_t id = 0; id <= maxid; ++id)
+            if (live[id]) {
+                a->free(live[id], "m61replay.c", __LINE__);
+                live[id] = NULL;
+            }
+        liveBytes = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &usage);
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    long rss = usage.ru_maxrss - baseline;
+    size_t ops = ncalls * repeat;
+    printf("%-6s %12zu ops %10.1f ns/op   peak live %10zu KB   peak RSS %10ld KB   fragmentation %6.1f%%",
+           a->name, ops, ns / (ops ? ops : 1), peakBytes / 1024, rss,
+           peakBytes ? (rss * 1024.0 / peakBytes - 1) * 100 : 0.0);
+    if (failed)
+        printf("   %zu failed", failed);
+    printf("\n");
+    exit(0);
+}
+
+void usage(void) {
+    fprintf(stderr, "Usage: m61replay [-n REPEAT] TRACE\n       m61replay -l LTRACELOG\n       m61replay -b M61TRACE\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int repeat = 1, opt;
+    while ((opt = getopt(argc, argv, "n:l:b:")) != -1) {
+        switch (opt) {
+        case 'n':
+            repeat = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'l':
+            return !convertLtrace(optarg);
+        case 'b':
+            return !convertBinary(optarg);
+        default:
+            usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+    if (!readTrace(argv[optind]))
+        return 1;
+    // output of the children must not be mixed up with buffered output of the parent
+    fflush(stdout);
+    for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); ++i) {
+        replay(&allocators[i], repeat);
+        fflush(stdout);
+    }
+    return 0;
+}
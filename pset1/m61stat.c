@@ -0,0 +1,145 @@
+#define M61_DISABLE 1
+#define _GNU_SOURCE
+#include "m61.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+// m61stat: shows the statistics that a program running with M61_STATS publishes, top-style.
+//
+//     m61stat [-i SECONDS] [-n COUNT] NAME|PID
+//
+// NAME is the value of M61_STATS, a PID stands for the page of M61_STATS=1.
+// The page is read every SECONDS seconds (default 1), COUNT times (default
+// forever). The target isn't stopped: m61stat copies the page until it gets a
+// copy that m61 didn't write to in the meantime.
+
+// copies the page, returns 0 if m61 kept writing to it
+int readPage(const struct m61_stats_page *page, struct m61_stats_page *copy) {
+    for (int attempt = 0; attempt < 1000; ++attempt) {
+        uint64_t before = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+        if (before % 2) {
+            sched_yield();
+            continue;
+        }
+        memcpy(copy, page, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->sequence, __ATOMIC_RELAXED) == before)
+            return 1;
+    }
+    return 0;
+}
+
+double rate(unsigned long long now, unsigned long long before, double seconds) {
+    return seconds > 0 && now >= before ? (now - before) / seconds : 0;
+}
+
+void printSites(const char *title, const struct m61_stats_site *sites, uint32_t n, unsigned long long total) {
+    printf("\n%s\n", title);
+    for (uint32_t i = 0; i < n && i < M61_STATS_SITES; ++i)
+        printf("  %14llu %5.1f%%  (error <= %llu)  %s:%d\n", sites[i].count,
+               total ? sites[i].count * 100.0 / total : 0.0, sites[i].error, sites[i].file, sites[i].line);
+}
+
+// prints the buckets that aren't empty with a bar each, the last bucket of an open histogram also counts everything bigger
+void printHistogram(const char *title, const unsigned long long *buckets, int n, int open) {
+    printf("\n%s\n", title);
+    unsigned long long most = 0;
+    for (int i = 0; i < n; ++i)
+        if (buckets[i] > most)
+            most = buckets[i];
+    for (int i = 0; i < n; ++i) {
+        if (!buckets[i])
+            continue;
+        unsigned long long low = i ? 1ULL << (i - 1) : 0, high = (1ULL << i) - 1;
+        int bar = (int) (buckets[i] * 40 / most);
+        if (open && i == n - 1)
+            printf("  %12llu and more   ", low);
+        else
+            printf("  %12llu - %-12llu", low, high);
+        printf(" %14llu  %.*s\n", buckets[i], bar > 0 ? bar : 1, "########################################");
+    }
+}
+
+void show(const struct m61_stats_page *now, const struct m61_stats_page *before, int clear) {
+    double seconds = before ? (now->time - before->time) / 1e9 : 0;
+    if (clear)
+        printf("\033[H\033[J");
+    printf("m61stat: pid %u, update %llu\n\n", now->pid, (unsigned long long) now->updates);
+    const struct m61_statistics *s = &now->stats;
+    printf("allocations: active %12llu   total %14llu   fail %10llu", s->active_count, s->total_count, s->fail_count);
+    if (before)
+        printf("   %12.0f/s", rate(s->total_count, before->stats.total_count, seconds));
+    printf("\nbytes:       active %12llu   total %14llu   fail %10llu", s->active_size, s->total_size, s->fail_size);
+    if (before)
+        printf("   %12.0f/s", rate(s->total_size, before->stats.total_size, seconds));
+    printf("\npeak:        active %12llu   bytes %14llu", now->peak_count, now->peak_size);
+    printf("\ncopied by realloc:   %12llu\n", s->copied_size);
+
+    printHistogram("sizes", now->size_histogram, M61_SIZEBUCKETS, 1);
+    printHistogram("lifetimes", now->lifetime_histogram, M61_LIFETIMEBUCKETS, 0);
+    printSites("top sites by allocations", now->frequent, now->nfrequent, s->total_count);
+    printSites("top sites by bytes", now->big, now->nbig, s->total_size);
+    fflush(stdout);
+}
+
+void usage(void) {
+    fprintf(stderr, "Usage: m61stat [-i SECONDS] [-n COUNT] NAME|PID\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    double interval = 1;
+    long count = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:")) != -1)
+        switch (opt) {
+        case 'i':
+            interval = strtod(optarg, 0);
+            break;
+        case 'n':
+            count = atol(optarg);
+            break;
+        default:
+            usage();
+        }
+    if (optind != argc - 1)
+        usage();
+
+    char name[256];
+    const char *arg = argv[optind];
+    if (arg[strspn(arg, "0123456789")] == '\0')
+        snprintf(name, sizeof(name), "/m61.%s", arg);
+    else
+        snprintf(name, sizeof(name), "%s%s", arg[0] == '/' ? "" : "/", arg);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        perror(name);
+        return 1;
+    }
+    const struct m61_stats_page *page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED || memcmp(page->magic, M61_STATS_MAGIC, 8) != 0 || page->version != M61_STATS_VERSION) {
+        fprintf(stderr, "%s: not an m61 statistics page\n", name);
+        return 1;
+    }
+
+    struct m61_stats_page pages[2];
+    int current = 0, shown = 0, clear = isatty(STDOUT_FILENO);
+    struct timespec sleep = {(time_t) interval, (long) ((interval - (time_t) interval) * 1e9)};
+    for (long i = 0; count < 0 || i < count; ++i) {
+        if (i)
+            nanosleep(&sleep, NULL);
+        if (!readPage(page, &pages[current])) {
+            fprintf(stderr, "%s: the page keeps changing\n", name);
+            continue;
+        }
+        show(&pages[current], shown ? &pages[!current] : NULL, clear);
+        shown = 1;
+        current = !current;
+    }
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// test029: compact mode keeps the allocation state in a side table.
+
+int main() {
+    setenv("M61_COMPACT", "1", 1);
+    char *a = (char *) malloc(100);
+    char *b = (char *) malloc(20);
+    char *c = (char *) malloc(200000);
+    free(a + 10);
+    free(b);
+    free(b);
+    b = (char *) malloc(8);
+    b[8] = 1;
+    free(b);
+    free(c);
+    m61_printleakreport();
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: test029.c:12: invalid free of pointer ???, not allocated
+//!   test029.c:9: ??? is 10 bytes inside a 100 byte region allocated here
+//! MEMORY BUG: test029.c:14: double free of pointer ???
+//!   test029.c:13: pointer ??? previously freed here
+//! MEMORY BUG: test029.c:17: detected wild write during free of pointer ???
+//! MEMORY BUG: test029.c:17: boundary write error!
+//! LEAK CHECK: test029.c:9: allocated object ??{0x\w+}?? with size 100
+//! malloc count: active          1   total          4   fail          0
+//! malloc size:  active        100   total     200128   fail          0
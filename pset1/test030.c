@@ -0,0 +1,25 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// test030: interior frees are resolved through the page map, also for large blocks.
+
+int main() {
+    char *small = (char *) malloc(3000);
+    char *large = (char *) malloc(10000000);
+    free(large + 9000000);
+    free(small + 2999);
+    free(large);
+    free(large);
+    free(small);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: test030.c:10: invalid free of pointer ???, not allocated
+//!   test030.c:9: ??? is 9000000 bytes inside a 10000000 byte region allocated here
+//! MEMORY BUG: test030.c:11: invalid free of pointer ???, not allocated
+//!   test030.c:8: ??? is 2999 bytes inside a 3000 byte region allocated here
+//! MEMORY BUG: test030.c:13: double free of pointer ???
+//!   test030.c:12: pointer ??? previously freed here
+//! malloc count: active          0   total          2   fail          0
+//! malloc size:  active          0   total   10003000   fail          0
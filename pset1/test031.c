@@ -0,0 +1,46 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+// test031: concurrent allocations and cross-thread frees keep exact statistics.
+
+#define NTHREADS 8
+#define NALLOCS 10000
+
+void *blocks[NTHREADS][NALLOCS];
+
+void *allocate(void *arg) {
+    void **mine = (void **) arg;
+    for (int i = 0; i < NALLOCS; ++i) {
+        mine[i] = malloc(i % 64 + 1);
+        if (i % 2)
+            free(mine[i]);
+    }
+    return NULL;
+}
+
+void *free_other(void *arg) {
+    void **theirs = (void **) arg;
+    for (int i = 0; i < NALLOCS; i += 2)
+        free(theirs[i]);
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[NTHREADS];
+    for (int i = 0; i < NTHREADS; ++i)
+        pthread_create(&threads[i], NULL, allocate, blocks[i]);
+    for (int i = 0; i < NTHREADS; ++i)
+        pthread_join(threads[i], NULL);
+    // every thread frees the blocks that the next thread left behind
+    for (int i = 0; i < NTHREADS; ++i)
+        pthread_create(&threads[i], NULL, free_other, blocks[(i + 1) % NTHREADS]);
+    for (int i = 0; i < NTHREADS; ++i)
+        pthread_join(threads[i], NULL);
+    m61_printstatistics();
+    m61_printleakreport();
+}
+
+//! malloc count: active          0   total      80000   fail          0
+//! malloc size:  active          0   total    2596928   fail          0
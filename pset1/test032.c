@@ -0,0 +1,31 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// test032: a small THETA set at runtime finds many sites, with exact counts.
+
+int main() {
+    setenv("M61_THETA", "2", 1);
+    for (int i = 0; i < 1000; ++i) {
+        for (int j = 0; j < 4; ++j)
+            free(malloc(10));
+        free(malloc(20));
+        free(malloc(30));
+        free(malloc(40));
+        free(malloc(50));
+    }
+    printHeavyHitterReport();
+}
+
+//! ---------------Heavy Hitter Report-----------------
+//! HEAVY HITTER: test032.c:11: 4000 allocations (~50%, error <= 0)
+//! HEAVY HITTER: test032.c:1??{[2-5]}??: 1000 allocations (~12%, error <= 0)
+//! HEAVY HITTER: test032.c:1??{[2-5]}??: 1000 allocations (~12%, error <= 0)
+//! HEAVY HITTER: test032.c:1??{[2-5]}??: 1000 allocations (~12%, error <= 0)
+//! HEAVY HITTER: test032.c:1??{[2-5]}??: 1000 allocations (~12%, error <= 0)
+//! HEAVY HITTER: test032.c:15: 50000 bytes (~27%, error <= 0)
+//! HEAVY HITTER: test032.c:1??{[14]}??: 40000 bytes (~22%, error <= 0)
+//! HEAVY HITTER: test032.c:1??{[14]}??: 40000 bytes (~22%, error <= 0)
+//! HEAVY HITTER: test032.c:13: 30000 bytes (~16%, error <= 0)
+//! HEAVY HITTER: test032.c:12: 20000 bytes (~11%, error <= 0)
+//! ---------------------------------------------------
@@ -0,0 +1,37 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// test033: sampling mode keeps exact statistics and memory bug checks, heavy hitters are estimated.
+
+void *leaks[1000];
+
+int main() {
+    setenv("M61_COMPACT", "0", 1);
+    setenv("M61_SAMPLE", "4096", 1);
+    for (int i = 0; i < 200000; ++i)
+        free(malloc(100));
+    for (int i = 0; i < 20000; ++i)
+        free(malloc(1000));
+    for (int i = 0; i < 1000; ++i)
+        leaks[i] = malloc(64);
+    char *ptr = malloc(8);
+    free(ptr);
+    free(ptr);
+    m61_printstatistics();
+    printHeavyHitterReport();
+    m61_printleakreport();
+}
+
+//! MEMORY BUG: test033.c:20: double free of pointer ??{0x\w+}=ptr??
+//!   test033.c:19: pointer ??ptr?? previously freed here
+//! malloc count: active       1000   total     221001   fail          0
+//! malloc size:  active      64000   total   40064008   fail          0
+//! ---------------Heavy Hitter Report-----------------
+//! HEAVY HITTER: test033.c:13: ??{19\d\d\d\d|20\d\d\d\d}?? allocations (~??{8[89]|9[0-2]}??%, error <= 0)
+//! HEAVY HITTER: test033.c:15: ??{19\d\d\d|20\d\d\d}?? allocations (~??{[89]|1[01]}??%, error <= 0)
+//! HEAVY HITTER: test033.c:1??{[35]}??: ??{\d+}?? bytes (~??{4[7-9]|5[0-2]}??%, error <= 0)
+//! HEAVY HITTER: test033.c:1??{[35]}??: ??{\d+}?? bytes (~??{4[7-9]|5[0-2]}??%, error <= 0)
+//! ---------------------------------------------------
+//! ???
+//! LEAK CHECK: the sampled objects stand for ~??{\d+}?? leaked objects with ~??{\d+}?? bytes
@@ -0,0 +1,54 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// test034: stack mode tells the callers of an allocation wrapper apart.
+
+void *xmalloc(size_t sz) {
+    return malloc(sz);
+}
+
+void parse(void) {
+    for (int i = 0; i < 3000; ++i)
+        free(xmalloc(32));
+}
+
+void *render(void) {
+    for (int i = 0; i < 999; ++i)
+        free(xmalloc(32));
+    return xmalloc(32);
+}
+
+int main() {
+    setenv("M61_COMPACT", "0", 1);
+    setenv("M61_STACKS", "3", 1);
+    parse();
+    void *ptr = render();
+    printHeavyHitterReport();
+    m61_printleakreport();
+    free(ptr);
+}
+
+//! ---------------Heavy Hitter Report-----------------
+//! HEAVY HITTER: test034.c:8: 3000 allocations (~75%, error <= 0)
+//!   #0 ??{0x\w+}?? xmalloc+0x??{\w+}?? (??{.*}??test034)
+//!   #1 ??{0x\w+}?? parse+0x??{\w+}?? (??{.*}??test034)
+//!   #2 ??{0x\w+}?? main+0x??{\w+}?? (??{.*}??test034)
+//! HEAVY HITTER: test034.c:8: 999 allocations (~24%, error <= 0)
+//!   #0 ??{0x\w+}?? xmalloc+0x??{\w+}?? (??{.*}??test034)
+//!   #1 ??{0x\w+}?? render+0x??{\w+}?? (??{.*}??test034)
+//!   #2 ??{0x\w+}?? main+0x??{\w+}?? (??{.*}??test034)
+//! HEAVY HITTER: test034.c:8: 96000 bytes (~75%, error <= 0)
+//!   #0 ??{0x\w+}?? xmalloc+0x??{\w+}?? (??{.*}??test034)
+//!   #1 ??{0x\w+}?? parse+0x??{\w+}?? (??{.*}??test034)
+//!   #2 ??{0x\w+}?? main+0x??{\w+}?? (??{.*}??test034)
+//! HEAVY HITTER: test034.c:8: 31968 bytes (~24%, error <= 0)
+//!   #0 ??{0x\w+}?? xmalloc+0x??{\w+}?? (??{.*}??test034)
+//!   #1 ??{0x\w+}?? render+0x??{\w+}?? (??{.*}??test034)
+//!   #2 ??{0x\w+}?? main+0x??{\w+}?? (??{.*}??test034)
+//! ---------------------------------------------------
+//! LEAK CHECK: test034.c:8: allocated object ??{0x\w+}?? with size 32
+//! LEAK CHECK: test034.c:8: 1 objects with 32 bytes leaked from this stack
+//!   #0 ??{0x\w+}?? xmalloc+0x??{\w+}?? (??{.*}??test034)
+//!   #1 ??{0x\w+}?? render+0x??{\w+}?? (??{.*}??test034)
+//!   #2 ??{0x\w+}?? main+0x??{\w+}?? (??{.*}??test034)
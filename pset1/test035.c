@@ -0,0 +1,40 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// test035: realloc resizes in place or remaps, and counts the bytes it copies.
+
+int main() {
+    struct m61_statistics stat;
+    // same size class: in place
+    char *p = (char *) malloc(100);
+    memset(p, 'A', 100);
+    char *q = (char *) realloc(p, 104);
+    assert(q == p && q[99] == 'A');
+    q = (char *) realloc(q, 97);
+    assert(q == p && q[96] == 'A');
+    // a growth loop copies only until the block is large, then it is remapped
+    size_t sz = 1;
+    char *buf = (char *) malloc(sz);
+    buf[0] = 'x';
+    while (sz < (64 << 20)) {
+        sz *= 2;
+        buf = (char *) realloc(buf, sz);
+        assert(buf[0] == 'x' && (sz < 4 || buf[sz / 2 - 1] == 'y'));
+        memset(buf + sz / 2, 'y', sz / 2);
+    }
+    m61_getstatistics(&stat);
+    assert(stat.copied_size < 32768);
+    // shrinking a large block keeps the data
+    buf = (char *) realloc(buf, 100000);
+    assert(buf[0] == 'x' && buf[99999] == 'y');
+    free(buf);
+    free(q);
+    q = (char *) realloc(q, 200);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: test035.c:33: double free of pointer ??{0x\w+}=ptr??
+//!   test035.c:32: pointer ??ptr?? previously freed here
+//! malloc count: active          1   total         32   fail          0
+//! malloc size:  active        200   total  134318228   fail          0
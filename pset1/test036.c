@@ -0,0 +1,41 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// test036: guard mode, an overrun of a large block faults right at the end of its payload.
+
+int main() {
+    setenv("M61_GUARD", "4096", 1);
+    char *p = (char *) malloc(5000);
+    assert(((uintptr_t) (p + 5008) & 4095) == 0);
+    memset(p, 'A', 5000);
+    pid_t child = fork();
+    if (child == 0) {
+        p[5008] = 'B';
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    printf("overrun %s\n", WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV ? "faulted" : "went unnoticed");
+    int *q = (int *) calloc(2000, sizeof(int));
+    for (int i = 0; i < 2000; ++i)
+        assert(q[i] == 0);
+    char *small = (char *) malloc(100);
+    free(small);
+    for (int i = 0; i < 200; ++i)
+        free(malloc(10000));
+    free(q);
+    free(q);
+    free(p);
+    m61_printstatistics();
+}
+
+//! overrun faulted
+//! MEMORY BUG: test036.c:32: double free of pointer ??{0x\w+}=ptr??
+//!   test036.c:31: pointer ??ptr?? previously freed here
+//! malloc count: active          0   total        203   fail          0
+//! malloc size:  active          0   total    2013100   fail          0
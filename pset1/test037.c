@@ -0,0 +1,29 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// test037: the quarantine keeps freed blocks from reuse and reports writes to them.
+
+int main() {
+    setenv("M61_QUARANTINE", "1000", 1);
+    char *q = (char *) malloc(40);
+    free(q);
+    for (int i = 0; i < 5; ++i) {
+        char *r = (char *) malloc(40);
+        assert(r != q);
+        free(r);
+    }
+    free(q);
+    char *p = (char *) malloc(100);
+    free(p);
+    p[10] = 'x';
+    for (int i = 0; i < 20; ++i)
+        free(malloc(100));
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: test037.c:16: double free of pointer ??{0x\w+}=ptr??
+//!   test037.c:10: pointer ??ptr?? previously freed here
+//! MEMORY BUG: test037.c:18: use after free of pointer ??{0x\w+}??, byte 10 was written after the pointer was freed here
+//! malloc count: active          0   total         27   fail          0
+//! malloc size:  active          0   total       2340   fail          0
@@ -0,0 +1,75 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// test038: the allocation trace records every call, it is written when the program exits.
+
+unsigned char trace[1 << 16];
+
+uint64_t varint(unsigned char **p) {
+    uint64_t value = 0;
+    for (int shift = 0; ; shift += 7) {
+        unsigned char byte = *(*p)++;
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+}
+
+int main() {
+    setenv("M61_TRACE", "out/test038.trace", 1);
+    pid_t child = fork();
+    if (child == 0) {
+        char *p = (char *) malloc(100);
+        p = (char *) realloc(p, 5000);
+        char *q = (char *) calloc(10, 10);
+        free(p);
+        free(q);
+        free(malloc(7));
+        exit(0);
+    }
+    waitpid(child, NULL, 0);
+    int fd = open("out/test038.trace", O_RDONLY);
+    ssize_t n = read(fd, trace, sizeof(trace));
+    close(fd);
+    assert(n > 16 && memcmp(trace, "M61TRACE", 8) == 0);
+    unsigned char *p = trace + 16;
+    while (p < trace + n) {
+        uint32_t len;
+        memcpy(&len, p, 4);
+        unsigned char *end = p + 16 + len;
+        for (p += 16; p < end; ) {
+            int op = *p++;
+            if (op == M61_TRACE_SITE) {
+                uint64_t id = varint(&p), line = varint(&p), namelen = varint(&p);
+                printf("site %d: %.*s:%d\n", (int) id, (int) namelen, (char *) p, (int) line);
+                p += namelen;
+                continue;
+            }
+            varint(&p);
+            uint64_t site = varint(&p);
+            uint64_t size = op == M61_TRACE_FREE ? 0 : varint(&p);
+            uint64_t token = varint(&p);
+            uint64_t newToken = op == M61_TRACE_REALLOC ? varint(&p) : 0;
+            printf("op %d site %d size %d %s\n", op, (int) site, (int) size,
+                   token && (op != M61_TRACE_REALLOC || newToken) ? "ok" : "null");
+        }
+    }
+}
+
+//! site 1: test038.c:26
+//! op 1 site 1 size 100 ok
+//! site 2: test038.c:27
+//! op 3 site 2 size 5000 ok
+//! site 3: test038.c:28
+//! op 4 site 3 size 100 ok
+//! site 4: test038.c:29
+//! op 2 site 4 size 0 ok
+//! site 5: test038.c:30
+//! op 2 site 5 size 0 ok
+//! site 6: test038.c:31
+//! op 1 site 6 size 7 ok
+//! op 2 site 6 size 0 ok
@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <malloc.h>
+// test039-target: a program that knows nothing about m61, test039 runs it with libm61.so preloaded.
+
+void *makeNode(size_t sz) {
+    return malloc(sz);
+}
+
+int main() {
+    for (int i = 0; i < 100; ++i)
+        free(makeNode(64));
+    void *p = makeNode(100);
+    printf("usable size %zu\n", malloc_usable_size(p));
+    p = realloc(p, 200);
+    void *aligned;
+    if (posix_memalign(&aligned, 64, 1000) == 0)
+        printf("aligned %d\n", (int) ((uintptr_t) aligned % 64 == 0));
+    free(aligned);
+    fflush(stdout);
+    void *volatile q = p;
+    free(q);
+    free(q);
+    return 0;
+}
@@ -0,0 +1,35 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// test039: libm61.so tracks a program that wasn't built with m61, call sites are return addresses.
+
+int main() {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        setenv("LD_PRELOAD", "./libm61.so", 1);
+        setenv("M61_REPORT", "sh", 1);
+        setenv("M61_COMPACT", "1", 1);
+        execl("./test039-target", "./test039-target", (char *) NULL);
+        _exit(1);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    printf("exit status %d\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+}
+
+//! usable size 100
+//! aligned 1
+//! MEMORY BUG: ./test039-target(main+??{0x\w+}??):0: double free of pointer ??{0x\w+}=ptr??
+//!   ./test039-target(main+??{0x\w+}??):0: pointer ??ptr?? previously freed here
+//! malloc count: active          1   total        104   fail          0
+//! malloc size:  active ??{ *\d+}??   total ??{ *\d+}??   fail          0
+//! ---------------Heavy Hitter Report-----------------
+//! HEAVY HITTER: ./test039-target(makeNode+??{0x\w+}??):0: 101 allocations (~??{\d+}??%, error <= 0)
+//! HEAVY HITTER: ./test039-target(makeNode+??{0x\w+}??):0: 6500 bytes (~??{\d+}??%, error <= 0)
+//! ???
+//! ---------------------------------------------------
+//! exit status 0
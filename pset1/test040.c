@@ -0,0 +1,49 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// test040: the statistics page of M61_STATS can be read by m61stat while the program runs.
+
+int main() {
+    setenv("M61_STATS", "m61-test040", 1);
+    setenv("M61_STATS_INTERVAL", "10", 1);
+    for (int i = 0; i < 1000; ++i)
+        free(malloc(8));
+    void *ptrs[100];
+    for (int i = 0; i < 100; ++i)
+        ptrs[i] = malloc(1000);
+    usleep(200000);
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        execl("./m61stat", "./m61stat", "-n", "1", "m61-test040", (char *) NULL);
+        _exit(1);
+    }
+    waitpid(child, NULL, 0);
+    for (int i = 0; i < 100; ++i)
+        free(ptrs[i]);
+}
+
+//! m61stat: pid ??{\d+}??, update ??{\d+}??
+//! 
+//! allocations: active          100   total           1100   fail          0
+//! bytes:       active       100000   total         108000   fail          0
+//! peak:        active          100   bytes         100000
+//! copied by realloc:              0
+//! 
+//! sizes
+//!              8 - 15                     1000  ########################################
+//!            512 - 1023                    100  ####
+//! 
+//! lifetimes
+//!              1 - 1                      1000  ########################################
+//! 
+//! top sites by allocations
+//!             1000  90.9%  (error <= 0)  test040.c:13
+//!              100   9.1%  (error <= 0)  test040.c:16
+//! 
+//! top sites by bytes
+//!           100000  92.6%  (error <= 0)  test040.c:16
+//!             8000   7.4%  (error <= 0)  test040.c:13
@@ -0,0 +1,55 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// test041: size and lifetime histograms of the whole program and of call sites.
+
+void print(const char *title, const unsigned long long *buckets, int n) {
+    printf("%s", title);
+    for (int i = 0; i < n; ++i)
+        if (buckets[i])
+            printf(" %d:%llu", i, buckets[i]);
+    printf("\n");
+}
+
+int main() {
+    setenv("M61_HISTOGRAMS", "1", 1);
+    // lifetimes 10, 9, ..., 1 on the allocation clock
+    void *ptrs[10];
+    int line;
+    for (int i = 0; i < 10; ++i)
+        ptrs[i] = malloc(100), line = __LINE__;
+    for (int i = 9; i >= 0; --i)
+        free(ptrs[i]);
+    for (int i = 0; i < 100; ++i)
+        free(malloc(i));
+    void *kept = malloc(100000);
+
+    struct m61_histograms histograms;
+    assert(m61_gethistograms(&histograms, __FILE__, line) == 0);
+    print("site sizes:", histograms.size, M61_SIZEBUCKETS);
+    print("site lifetimes:", histograms.lifetime, M61_LIFETIMEBUCKETS);
+    assert(m61_gethistograms(&histograms, NULL, 0) == 0);
+    print("sizes:", histograms.size, M61_SIZEBUCKETS);
+    print("lifetimes:", histograms.lifetime, M61_LIFETIMEBUCKETS);
+    printHeavyHitterReport();
+    free(kept);
+}
+
+//! site sizes: 7:10
+//! site lifetimes: 1:1 2:2 3:4 4:3
+//! sizes: 0:1 1:1 2:2 3:4 4:8 5:16 6:32 7:46 17:1
+//! lifetimes: 1:101 2:2 3:4 4:3
+//! ---------------Heavy Hitter Report-----------------
+//! HEAVY HITTER: test041.c:25: 100 allocations (~90%, error <= 0)
+//!   sizes: 0:1 1:1 2-3:2 4-7:4 8-15:8 16-31:16 32-63:32 64-127:36
+//!   lifetimes: 1:100
+//! HEAVY HITTER: test041.c:21: 10 allocations (~9%, error <= 0)
+//!   sizes: 64-127:10
+//!   lifetimes: 1:1 2-3:2 4-7:4 8-15:3
+//! HEAVY HITTER: test041.c:26: 100000 bytes (~94%, error <= 0)
+//!   sizes: 65536-131071:1
+//!   lifetimes:
+//! HISTOGRAM: sizes: 0:1 1:1 2-3:2 4-7:4 8-15:8 16-31:16 32-63:32 64-127:46 65536-131071:1
+//! HISTOGRAM: lifetimes: 1:101 2-3:2 4-7:4 8-15:3
+//! ---------------------------------------------------
@@ -0,0 +1,64 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+// test042: peaks of the active allocations and bytes, and a timeline with a snapshot every 64 allocations.
+
+void print(const char *title, const struct m61_peaks *peaks) {
+    printf("%s: %llu allocations at %s:%d, %llu bytes at %s:%d\n", title,
+           peaks->count, peaks->count_file, peaks->count_line,
+           peaks->size, peaks->size_file, peaks->size_line);
+}
+
+int main() {
+    setenv("M61_PEAKS", "1", 1);
+    setenv("M61_TIMELINE", "test042.timeline", 1);
+    setenv("M61_TIMELINE_ALLOCATIONS", "64", 1);
+    void *ptrs[100];
+    int small, big;
+    for (int i = 0; i < 100; ++i)
+        ptrs[i] = malloc(1000), small = __LINE__;
+    for (int i = 0; i < 100; ++i)
+        free(ptrs[i]);
+    for (int i = 0; i < 50; ++i)
+        ptrs[i] = malloc(3000), big = __LINE__;
+    for (int i = 0; i < 50; ++i)
+        free(ptrs[i]);
+
+    struct m61_peaks peaks;
+    assert(m61_getpeaks(&peaks, NULL, 0) == 0);
+    print("program", &peaks);
+    assert(m61_getpeaks(&peaks, __FILE__, small) == 0);
+    print("small", &peaks);
+    assert(m61_getpeaks(&peaks, __FILE__, big) == 0);
+    print("big", &peaks);
+    printHeavyHitterReport();
+
+    FILE *timeline = fopen("test042.timeline", "r");
+    assert(timeline);
+    char line[1024];
+    while (fgets(line, sizeof(line), timeline))
+        printf("timeline: %s", line);
+    fclose(timeline);
+    unlink("test042.timeline");
+}
+
+//! program: 100 allocations at test042.c:21, 150000 bytes at test042.c:25
+//! small: 100 allocations at test042.c:21, 100000 bytes at test042.c:21
+//! big: 50 allocations at test042.c:25, 150000 bytes at test042.c:25
+//! ---------------Heavy Hitter Report-----------------
+//! HEAVY HITTER: test042.c:21: 100 allocations (~66%, error <= 0)
+//!   peak: 100 allocations, 100000 bytes
+//! HEAVY HITTER: test042.c:25: 50 allocations (~33%, error <= 0)
+//!   peak: 50 allocations, 150000 bytes
+//! HEAVY HITTER: test042.c:25: 150000 bytes (~60%, error <= 0)
+//!   peak: 50 allocations, 150000 bytes
+//! HEAVY HITTER: test042.c:21: 100000 bytes (~40%, error <= 0)
+//!   peak: 100 allocations, 100000 bytes
+//! PEAK: 100 active allocations, reached by an allocation at test042.c:21
+//! PEAK: 150000 active bytes, reached by an allocation at test042.c:25
+//! ---------------------------------------------------
+//! timeline: ??{\d+}?? 0 0
+//! timeline: ??{\d+}?? 64 64000 test042.c:21=64000
+//! timeline: ??{\d+}?? 28 84000 test042.c:25=84000
@@ -0,0 +1,45 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// test043: snapshots of the live allocations and the growth between two of them.
+
+void *leaky[100];
+int nleaky;
+
+void serve(int requests) {
+    for (int i = 0; i < requests; ++i) {
+        void *request = malloc(200);
+        if (i % 10 == 0)
+            leaky[nleaky++] = malloc(64);
+        free(request);
+    }
+}
+
+int main() {
+    void *cache = malloc(5000);
+    serve(10);
+    struct m61_snapshot *before = m61_snapshot();
+    assert(before);
+    for (size_t i = 0; i < before->nsites; ++i)
+        printf("before: %s:%d: %llu objects with %llu bytes\n", before->sites[i].file, before->sites[i].line,
+               before->sites[i].count, before->sites[i].size);
+
+    serve(50);
+    free(cache);
+    void *table = malloc(1000);
+    struct m61_snapshot *after = m61_snapshot();
+    assert(m61_snapshot_diff(before, after) == 2);
+    assert(m61_snapshot_diff(after, before) == 1);
+    m61_snapshot_free(before);
+    m61_snapshot_free(after);
+    free(table);
+    for (int i = 0; i < nleaky; ++i)
+        free(leaky[i]);
+}
+
+//! before: test043.c:20: 1 objects with 5000 bytes
+//! before: test043.c:14: 1 objects with 64 bytes
+//! SNAPSHOT DIFF: test043.c:30: +1 objects, +1000 bytes (1 objects with 1000 bytes live)
+//! SNAPSHOT DIFF: test043.c:14: +5 objects, +320 bytes (6 objects with 384 bytes live)
+//! SNAPSHOT DIFF: test043.c:20: +1 objects, +5000 bytes (1 objects with 5000 bytes live)
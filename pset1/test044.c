@@ -0,0 +1,58 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// test044: leak summary by call site, with the mark phase telling lost blocks from reachable ones.
+
+struct node {
+    struct node *next;
+    char payload[24];
+};
+typedef struct node node;
+
+node *global;
+
+// builds a list of n nodes that is reachable from the global
+void keep(int n) {
+    for (int i = 0; i < n; ++i) {
+        node *n = (node *) malloc(sizeof(node));
+        n->next = global;
+        global = n;
+    }
+}
+
+// builds a list of n nodes and forgets it
+__attribute__((noinline)) void lose(int n) {
+    node *list = NULL;
+    for (int i = 0; i < n; ++i) {
+        node *n = (node *) malloc(sizeof(node));
+        n->next = list;
+        list = n;
+    }
+    memset(&list, 0, sizeof(list));
+}
+
+int main() {
+    keep(1000);
+    lose(3);
+    char *onStack = (char *) malloc(100);
+    // lost blocks that point to a reachable block stay lost
+    node *last = (node *) malloc(sizeof(node));
+    last->next = global;
+    last = NULL;
+    m61_printleaksummary(0);
+    m61_printleaksummary(1);
+    assert(onStack);
+    free(onStack);
+}
+
+//! LEAK SUMMARY: test044.c:18: 1000 objects with 32000 bytes leaked
+//! LEAK SUMMARY: test044.c:38: 1 objects with 100 bytes leaked
+//! LEAK SUMMARY: test044.c:28: 3 objects with 96 bytes leaked
+//! LEAK SUMMARY: test044.c:40: 1 objects with 32 bytes leaked
+//! LEAK SUMMARY: 1005 objects with 32228 bytes leaked from 4 call sites
+//! LEAK SUMMARY: test044.c:28: 3 objects with 96 bytes definitely lost
+//! LEAK SUMMARY: test044.c:40: 1 objects with 32 bytes definitely lost
+//! LEAK SUMMARY: test044.c:18: 1000 objects with 32000 bytes still reachable
+//! LEAK SUMMARY: test044.c:38: 1 objects with 100 bytes still reachable
+//! LEAK SUMMARY: 4 objects with 128 bytes definitely lost, 1001 objects with 32100 bytes still reachable
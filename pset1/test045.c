@@ -0,0 +1,50 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+// test045: arena allocations are counted and tracked, and released all at once.
+
+int main() {
+    m61_arena *arena = m61_arena_create();
+    assert(arena);
+    char *first = NULL;
+    for (int i = 0; i < 1000; ++i) {
+        char *p = (char *) m61_arena_alloc(arena, 24, __FILE__, __LINE__);
+        assert(p && (uintptr_t) p % 16 == 0);
+        memset(p, i, 24);
+        if (!first)
+            first = p;
+    }
+    assert(first[0] == 0 && first[23] == 0);
+    char *big = (char *) m61_arena_alloc(arena, 100000, __FILE__, __LINE__);
+    memset(big, 1, 100000);
+    char *small = (char *) m61_arena_alloc(arena, 8, __FILE__, __LINE__);
+    assert(small && small != big);
+    m61_printstatistics();
+
+    free(first);
+    assert(realloc(small, 100) == NULL);
+
+    m61_arena_reset(arena, __FILE__, __LINE__);
+    m61_printstatistics();
+    char *again = (char *) m61_arena_alloc(arena, 24, __FILE__, __LINE__);
+    assert(again == first);
+    m61_arena_destroy(arena, __FILE__, __LINE__);
+    m61_printstatistics();
+    printHeavyHitterReport();
+}
+
+//! malloc count: active       1002   total       1002   fail          0
+//! malloc size:  active     124008   total     124008   fail          0
+//! MEMORY BUG: test045.c:26: invalid free of pointer ???, allocated from an arena
+//! MEMORY BUG: test045.c:27: invalid realloc of pointer ???, allocated from an arena
+//! malloc count: active          0   total       1002   fail          0
+//! malloc size:  active          0   total     124008   fail          0
+//! malloc count: active          0   total       1003   fail          0
+//! malloc size:  active          0   total     124032   fail          0
+//! ---------------Heavy Hitter Report-----------------
+//! HEAVY HITTER: test045.c:13: 1000 allocations (~99%, error <= 0)
+//! HEAVY HITTER: test045.c:20: 100000 bytes (~80%, error <= 0)
+//! HEAVY HITTER: test045.c:13: 24000 bytes (~19%, error <= 0)
+//! ---------------------------------------------------
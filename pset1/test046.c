@@ -0,0 +1,46 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+// test046: frees of blocks whose thread is still running go through its remote free queue.
+
+#define NALLOCS 1000
+
+void *blocks[NALLOCS];
+pthread_barrier_t barrier;
+
+void *allocate(void *arg) {
+    (void) arg;
+    for (int i = 0; i < NALLOCS; ++i)
+        blocks[i] = malloc(i % 100 + 1);
+    pthread_barrier_wait(&barrier);
+    // main frees all blocks but the first one and prints its reports
+    pthread_barrier_wait(&barrier);
+    free(blocks[1]);
+    for (int i = 0; i < NALLOCS; ++i)
+        assert(malloc(i % 100 + 1) != blocks[0]);
+    return NULL;
+}
+
+int main() {
+    pthread_barrier_init(&barrier, NULL, 2);
+    pthread_t thread;
+    pthread_create(&thread, NULL, allocate, NULL);
+    pthread_barrier_wait(&barrier);
+    for (int i = 1; i < NALLOCS; ++i)
+        free(blocks[i]);
+    m61_printstatistics();
+    m61_printleakreport();
+    pthread_barrier_wait(&barrier);
+    pthread_join(thread, NULL);
+    m61_printstatistics();
+}
+
+//! malloc count: active          1   total       1000   fail          0
+//! malloc size:  active          1   total      50500   fail          0
+//! LEAK CHECK: test046.c:16: allocated object ??? with size 1
+//! MEMORY BUG: test046.c:20: double free of pointer ???
+//!   test046.c:32: pointer ??? previously freed here
+//! malloc count: active       1001   total       2000   fail          0
+//! malloc size:  active      50501   total     101000   fail          0
@@ -0,0 +1,46 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+// test047: aligned allocations are tracked like any other, with metadata and backpack around the aligned payload.
+
+int main() {
+    size_t alignments[] = {32, 64, 128, 4096, 8192};
+    size_t sizes[] = {1, 100, 1000, 20000};
+    void *ptrs[20];
+    int n = 0;
+    for (int i = 0; i < 5; ++i)
+        for (int j = 0; j < 4; ++j) {
+            char *p = (char *) memalign(alignments[i], sizes[j]);
+            assert(p && (uintptr_t) p % alignments[i] == 0);
+            assert(malloc_usable_size(p) == sizes[j]);
+            memset(p, 1, sizes[j]);
+            ptrs[n++] = p;
+        }
+    for (int i = 0; i < n; ++i)
+        free(ptrs[i]);
+
+    void *p = NULL;
+    assert(posix_memalign(&p, 24, 100) == EINVAL);
+    assert(posix_memalign(&p, 64, 100) == 0 && (uintptr_t) p % 64 == 0);
+    void *q = aligned_alloc(256, 512);
+    assert(q && (uintptr_t) q % 256 == 0);
+    assert(memalign(3, 10) == NULL);
+    m61_printstatistics();
+
+    free_sized(q, 512);
+    free_sized(p, 50);
+    assert(malloc_usable_size(p) == 0);
+
+    char *r = (char *) memalign(64, 10);
+    r[10] = 'x';
+    free(r);
+}
+
+//! malloc count: active          2   total         22   fail          0
+//! malloc size:  active        612   total     106117   fail          0
+//! MEMORY BUG: test047.c:34: free of pointer ??? with size 50, but it was allocated with size 100
+//! MEMORY BUG???: detected wild write during free of pointer ???
+//! ???
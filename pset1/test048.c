@@ -0,0 +1,39 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// test048: call sites are interned once per macro expansion, and file names with the same contents share their sites.
+
+char copy[] = __FILE__;     // the same name at another address, like the name emitted by another translation unit
+
+void *allocate(size_t sz) {
+    return malloc(sz);
+}
+
+int main() {
+    assert(copy != (char *) __FILE__);
+    uint32_t first = M61_SITE(), again = 0;
+    for (int i = 0; i < 2; ++i)
+        again = M61_SITE();
+    assert(first && again && first != again);
+    assert(m61_intern_site(&again, copy, 15) == first);
+
+    for (int i = 0; i < 100; ++i) {
+        free(allocate(1000));
+        m61_free(m61_malloc(500, __FILE__, 23), __FILE__, 23);
+        m61_free(m61_malloc(500, copy, 23), copy, 23);
+    }
+    char *p = (char *) m61_malloc(10, copy, 26);
+    m61_free(p, __FILE__, 27);
+    m61_free(p, copy, 28);
+    printHeavyHitterReport();
+}
+
+//! MEMORY BUG: test048.c:28: double free of pointer ???
+//!   test048.c:27: pointer ??? previously freed here
+//! ---------------Heavy Hitter Report-----------------
+//! HEAVY HITTER: test048.c:23: 200 allocations (~66%, error <= 0)
+//! HEAVY HITTER: test048.c:10: 100 allocations (~33%, error <= 0)
+//! HEAVY HITTER: test048.c:10: 100000 bytes (~49%, error <= 0)
+//! HEAVY HITTER: test048.c:23: 100000 bytes (~49%, error <= 0)
+//! ---------------------------------------------------
@@ -0,0 +1,30 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+// test049: writes into the redzone behind the backpack are found by a sweep of the live blocks, and reported once.
+
+int main() {
+    setenv("M61_REDZONE", "40", 1);
+    char *intact = (char *) malloc(100);
+    char *p = (char *) malloc(20000);  // big enough for full metadata in compact mode too
+    memset(intact, 1, 100);
+    p[20020] = 'x';             // skips the backpack, into the redzone
+    m61_sweep();
+    m61_sweep();
+    free(intact);
+    free(p);
+
+    char *q = (char *) malloc(20);
+    char *r = (char *) malloc(20000);
+    memset(r - 8, 0, 8);        // the end of the metadata
+    m61_sweep();
+    free(q);
+    m61_sweep();
+}
+
+//! MEMORY BUG: test049.c:11: detected wild write past the end of allocated object ??? with size 20000
+//! MEMORY BUG: test049.c:17: detected wild write during free of pointer ???
+//! MEMORY BUG: test049.c:17: boundary write error!
+//! MEMORY BUG: test049.c:20: detected wild write into the metadata of allocated object ???
@@ -0,0 +1,34 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+// test050: the bounds level checks every free but tracks nothing.
+
+int main() {
+    setenv("M61_LEVEL", "bounds", 1);
+    setenv("M61_SAMPLE", "1", 1);       // ignored below the full level
+    char *p = (char *) malloc(100);
+    char *q = (char *) realloc(malloc(10), 50);
+    char *r = (char *) calloc(10, 10);
+    assert(r[99] == 0);
+    free(p);
+    free(p);
+    q[50] = 'x';
+    free(q);
+    free(r + 10);
+    m61_printstatistics();
+    m61_printleakreport();
+    printHeavyHitterReport();
+}
+
+//! MEMORY BUG: test050.c:16: double free of pointer ???
+//!   test050.c:15: pointer ??? previously freed here
+//! MEMORY BUG: test050.c:18: detected wild write during free of pointer ???
+//! MEMORY BUG: test050.c:18: boundary write error!
+//! MEMORY BUG: test050.c:19: invalid free of pointer ???, not allocated
+//!   test050.c:13: ??? is 10 bytes inside a 100 byte region allocated here
+//! malloc count: active          1   total          4   fail          0
+//! malloc size:  active        100   total        260   fail          0
+//! ---------------Heavy Hitter Report-----------------
+//! ---------------------------------------------------
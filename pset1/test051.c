@@ -0,0 +1,29 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+// test051: the counters level keeps exact statistics without any checks.
+
+int main() {
+    setenv("M61_LEVEL", "counters", 1);
+    setenv("M61_REDZONE", "64", 1);     // ignored below the bounds level
+    void *ptrs[100];
+    for (int i = 0; i < 100; ++i)
+        ptrs[i] = malloc(i + 1);
+    for (int i = 0; i < 100; i += 2)
+        free(ptrs[i]);
+    char *q = (char *) realloc(ptrs[1], 1000);
+    char *a = (char *) memalign(4096, 20000);
+    assert(q && a && (uintptr_t) a % 4096 == 0);
+    assert(malloc_usable_size(a) == 20000);
+    a[20000] = 'x';             // not checked
+    free(a);
+    free(q);
+    m61_printstatistics();
+    m61_printleakreport();
+}
+
+//! malloc count: active         49   total        102   fail          0
+//! malloc size:  active       2548   total      26050   fail          0
@@ -0,0 +1,44 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+// test052: small aligned blocks of compact mode come from the slabs instead of a mapping each.
+
+char *ptrs[1000];
+
+int main() {
+    setenv("M61_COMPACT", "1", 1);
+    uintptr_t lo = UINTPTR_MAX, hi = 0;
+    for (int i = 0; i < 1000; ++i) {
+        ptrs[i] = (char *) memalign(64, 40);
+        assert(ptrs[i] && (uintptr_t) ptrs[i] % 64 == 0);
+        assert(malloc_usable_size(ptrs[i]) == 40);
+        memset(ptrs[i], i, 40);
+        lo = (uintptr_t) ptrs[i] < lo ? (uintptr_t) ptrs[i] : lo;
+        hi = (uintptr_t) ptrs[i] > hi ? (uintptr_t) ptrs[i] : hi;
+    }
+    // a mapping of its own would put every block on a page of its own
+    assert(hi - lo < 1000 * 512);
+    char *page = (char *) memalign(4096, 100);
+    assert(page && (uintptr_t) page % 4096 == 0);
+    for (int i = 0; i < 1000; ++i)
+        free(ptrs[i]);
+    free(ptrs[0]);
+    free(page + 10);
+    free_sized(page, 50);
+    char *leak = (char *) aligned_alloc(256, 200);
+    assert((uintptr_t) leak % 256 == 0);
+    m61_printstatistics();
+    m61_printleakreport();
+}
+
+//! MEMORY BUG: test052.c:28: double free of pointer ???
+//!   test052.c:27: pointer ??? previously freed here
+//! MEMORY BUG: test052.c:29: invalid free of pointer ???, not allocated
+//!   test052.c:24: ??? is 10 bytes inside a 100 byte region allocated here
+//! MEMORY BUG: test052.c:30: free of pointer ??? with size 50, but it was allocated with size 100
+//! malloc count: active          1   total       1002   fail          0
+//! malloc size:  active        200   total      40300   fail          0
+//! LEAK CHECK: test052.c:31: allocated object ??? with size 200
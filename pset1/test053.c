@@ -0,0 +1,72 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// test053: a child forked by a traced program isn't traced, the trace of the parent stays whole.
+
+unsigned char trace[1 << 20];
+
+uint64_t varint(unsigned char **p) {
+    uint64_t value = 0;
+    for (int shift = 0; ; shift += 7) {
+        unsigned char byte = *(*p)++;
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+}
+
+int main() {
+    setenv("M61_TRACE", "out/test053.trace", 1);
+    pid_t traced = fork();
+    if (traced == 0) {
+        free(malloc(10));
+        pid_t child = fork();
+        if (child == 0) {
+            free(malloc(20));
+            exit(0);
+        }
+        waitpid(child, NULL, 0);
+        // enough events to drain the buffer a few times, past the end of the file as the child left it
+        for (int i = 0; i < 20000; ++i)
+            free(malloc(30));
+        exit(0);
+    }
+    int status;
+    waitpid(traced, &status, 0);
+    printf("traced program %s\n", WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "exited" : "crashed");
+    int fd = open("out/test053.trace", O_RDONLY);
+    ssize_t n = read(fd, trace, sizeof(trace));
+    close(fd);
+    assert(n > 16 && n < (ssize_t) sizeof(trace) && memcmp(trace, "M61TRACE", 8) == 0);
+    unsigned long long sizes[40] = {0};
+    unsigned char *p = trace + 16;
+    while (p < trace + n) {
+        uint32_t len;
+        memcpy(&len, p, 4);
+        unsigned char *end = p + 16 + len;
+        for (p += 16; p < end; ) {
+            int op = *p++;
+            if (op == M61_TRACE_SITE) {
+                varint(&p);
+                varint(&p);
+                p += varint(&p);
+                continue;
+            }
+            varint(&p);
+            varint(&p);
+            uint64_t size = op == M61_TRACE_FREE ? 0 : varint(&p);
+            varint(&p);
+            if (op == M61_TRACE_MALLOC && size < 40)
+                ++sizes[size];
+        }
+    }
+    printf("malloc(10) %llu, malloc(20) %llu, malloc(30) %llu\n", sizes[10], sizes[20], sizes[30]);
+}
+
+//! traced program exited
+//! malloc(10) 1, malloc(20) 0, malloc(30) 20000
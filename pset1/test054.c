@@ -0,0 +1,53 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+// test054: a key destructor that runs after the shard of its thread was retired and adopted doesn't share the shard.
+
+pthread_key_t key;
+pthread_barrier_t barrier;
+void *freed;
+
+void *adopt(void *arg) {
+    (void) arg;
+    freed = malloc(24);
+    free(freed);
+    pthread_barrier_wait(&barrier);
+    // the exiting thread allocates now
+    pthread_barrier_wait(&barrier);
+    return NULL;
+}
+
+void destroy(void *arg) {
+    (void) arg;
+    pthread_t thread;
+    pthread_create(&thread, NULL, adopt, NULL);
+    pthread_barrier_wait(&barrier);
+    void *ptr = malloc(24);
+    printf("block freed by the adopting thread %s\n", ptr == freed ? "reused" : "not reused");
+    free(ptr);
+    pthread_barrier_wait(&barrier);
+    pthread_join(thread, NULL);
+}
+
+void *run(void *arg) {
+    (void) arg;
+    free(malloc(24));
+    pthread_setspecific(key, &key);
+    return NULL;
+}
+
+int main() {
+    free(malloc(1));
+    pthread_key_create(&key, destroy);
+    pthread_barrier_init(&barrier, NULL, 2);
+    pthread_t thread;
+    pthread_create(&thread, NULL, run, NULL);
+    pthread_join(thread, NULL);
+    m61_printstatistics();
+}
+
+//! block freed by the adopting thread not reused
+//! malloc count: active          0   total          4   fail          0
+//! malloc size:  active          0   total         73   fail          0
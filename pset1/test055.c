@@ -0,0 +1,34 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// test055: compact mode, a realloc that grows a block of a slab to a guarded size moves it to a guarded block.
+
+int main() {
+    setenv("M61_COMPACT", "1", 1);
+    setenv("M61_GUARD", "1000", 1);
+    char *p = (char *) malloc(990);
+    memset(p, 'A', 990);
+    p = (char *) realloc(p, 1000);
+    assert(((uintptr_t) (p + 1008) & 4095) == 0);
+    for (int i = 0; i < 990; ++i)
+        assert(p[i] == 'A');
+    pid_t child = fork();
+    if (child == 0) {
+        p[1008] = 'B';
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    printf("overrun %s\n", WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV ? "faulted" : "went unnoticed");
+    free(p);
+    m61_printstatistics();
+}
+
+//! overrun faulted
+//! malloc count: active          0   total          2   fail          0
+//! malloc size:  active          0   total       1990   fail          0
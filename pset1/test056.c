@@ -0,0 +1,25 @@
+#define M61_NO_SITE_CACHE 1
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// test056: with M61_NO_SITE_CACHE, inline functions that aren't static can allocate, and their sites are still told apart.
+
+inline char *duplicate(const char *s) {
+    char *copy = (char *) malloc(strlen(s) + 1);
+    return strcpy(copy, s);
+}
+char *duplicate(const char *s);
+
+int main() {
+    for (int i = 0; i < 10; ++i)
+        free(duplicate("site"));
+    char *leak = duplicate("leak");
+    assert(strcmp(leak, "leak") == 0);
+    free(leak + 1);
+    m61_printleakreport();
+}
+
+//! MEMORY BUG: test056.c:19: invalid free of pointer ???, not allocated
+//!   test056.c:9: ??? is 1 bytes inside a 5 byte region allocated here
+//! LEAK CHECK: test056.c:9: allocated object ??? with size 5
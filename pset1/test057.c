@@ -0,0 +1,32 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// test057: M61_LEVEL accepts full, any other value it doesn't know gets a warning and the full checks.
+
+void doubleFree(void) {
+    char *p = (char *) malloc(10);
+    free(p);
+    free(p);
+}
+
+int main() {
+    pid_t child = fork();
+    if (child == 0) {
+        setenv("M61_LEVEL", "full", 1);
+        doubleFree();
+        exit(0);
+    }
+    waitpid(child, NULL, 0);
+    setenv("M61_LEVEL", "Bounds", 1);
+    doubleFree();
+}
+
+//! MEMORY BUG: test057.c:13: double free of pointer ???
+//!   test057.c:12: pointer ??? previously freed here
+//! WARNING: M61_LEVEL=Bounds is not one of off, counters, bounds, full; checking at level full
+//! MEMORY BUG: test057.c:13: double free of pointer ???
+//!   test057.c:12: pointer ??? previously freed here